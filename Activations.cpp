@@ -25,7 +25,7 @@ namespace af
 
         Variable ReLU::forward(const Variable& input)
         {
-            return max(input, 0.0);
+            return relu(input);
         }
 
         LeakyReLU::LeakyReLU(double slope) :
@@ -35,7 +35,7 @@ namespace af
 
         Variable LeakyReLU::forward(const Variable& input)
         {
-            return max(input, m_slope * input);
+            return leakyRelu(input, m_slope);
         }
 
         PReLU::PReLU(int size, double value)
@@ -51,8 +51,7 @@ namespace af
 
         Variable PReLU::forward(const Variable& input)
         {
-            auto mask = input >= 0.0;
-            return (input * mask) + (input * !mask * tileAs(m_parameters[0], input));
+            return prelu(input, m_parameters[0]);
         }
 
         ELU::ELU(double alpha) :
@@ -62,8 +61,7 @@ namespace af
 
         Variable ELU::forward(const Variable& input)
         {
-            auto mask = input >= 0.0;
-            return (mask * input) + (!mask * m_alpha * (exp(input) - 1));
+            return elu(input, m_alpha);
         }
 
         ThresholdReLU::ThresholdReLU(double threshold) :
@@ -73,8 +71,7 @@ namespace af
 
         Variable ThresholdReLU::forward(const Variable& input)
         {
-            auto mask = input >= m_threshold;
-            return input * mask;
+            return thresholdRelu(input, m_threshold);
         }
     }
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include "Variable.h"
+#include "Functions.h"
 #include "Container.h"
+#include "Dropout.h"
+
+#include <algorithm>
 
 namespace af
 {
@@ -19,13 +23,54 @@ namespace af
             return m_modules;
         }
 
-        Sequential::Sequential() {}
+        Sequential::Sequential() :
+            m_checkpoint_size(0)
+        {
+        }
+
+        void Sequential::setCheckpointSize(int modules_per_segment)
+        {
+            m_checkpoint_size = modules_per_segment;
+        }
 
         Variable Sequential::forward(const Variable& input)
         {
             Variable output = input;
-            for (auto& module : m_modules) {
-                output = module->forward(output);
+            if (m_checkpoint_size <= 0 || !Variable::isGradEnabled()) {
+                for (auto& module : m_modules) {
+                    output = module->forward(output);
+                }
+                return output;
+            }
+
+            for (size_t begin = 0; begin < m_modules.size(); begin += m_checkpoint_size) {
+                size_t end = std::min(begin + (size_t)m_checkpoint_size, m_modules.size());
+                std::vector<ModulePtr> segment(m_modules.begin() + begin, m_modules.begin() + end);
+                std::vector<Variable> parameters;
+                for (auto& module : segment) {
+                    for (auto& parameter : module->parameters()) {
+                        parameters.push_back(parameter);
+                    }
+                }
+                // The recompute in backward has to draw the same dropout masks as
+                // the forward pass, and then leave the thread's stream where it
+                // was so that later steps still get fresh masks.
+                auto state = Dropout::randomState();
+                auto recomputing = std::make_shared<bool>(false);
+                auto fn = [segment, state, recomputing](const Variable& segment_input) {
+                    auto resume = Dropout::randomState();
+                    Dropout::setRandomState(state);
+                    Variable segment_output = segment_input;
+                    for (auto& module : segment) {
+                        segment_output = module->forward(segment_output);
+                    }
+                    if (*recomputing) {
+                        Dropout::setRandomState(resume);
+                    }
+                    *recomputing = true;
+                    return segment_output;
+                };
+                output = checkpoint(fn, output, parameters);
             }
             return output;
         }
@@ -37,10 +37,20 @@ namespace af
 
         class Sequential : public Container
         {
+        private:
+            int m_checkpoint_size;
+
         public:
 
             Sequential();
 
+            // Runs forward in checkpointed segments of the given number of modules
+            // (0 disables). Only segment boundary activations are kept for backward;
+            // segments are recomputed during backward. About sqrt(N) modules per
+            // segment gives O(sqrt(N)) activation memory for N modules. Dropout
+            // inside a segment is replayed with the masks of the forward pass.
+            void setCheckpointSize(int modules_per_segment);
+
             autograd::Variable forward(const autograd::Variable& input);
         };
     }
@@ -0,0 +1,112 @@
+#include "Variable.h"
+
+#include "Init.h"
+#include "Conv.h"
+
+namespace af
+{
+    namespace nn
+    {
+        using namespace autograd;
+
+        static int outputSize(dim_t input, int w, int s, int p)
+        {
+            return (int)((input + 2 * p - w) / s + 1);
+        }
+
+        Conv2D::Conv2D(int input_channels, int output_channels,
+            int wx, int wy, int sx, int sy, int px, int py, bool bias) :
+            m_bias(bias),
+            m_wx(wx), m_wy(wy),
+            m_sx(sx), m_sy(sy),
+            m_px(px), m_py(py)
+        {
+            auto w = nn::lecunNormal(output_channels, wx * wy * input_channels);
+            if (bias) {
+                auto b = nn::lecunNormal(output_channels, 1);
+                setParams({ w, b });
+            }
+            else {
+                setParams({ w });
+            }
+        }
+
+        Conv2D::Conv2D(const Variable& w, int wx, int wy, int sx, int sy, int px, int py) :
+            m_bias(false),
+            m_wx(wx), m_wy(wy),
+            m_sx(sx), m_sy(sy),
+            m_px(px), m_py(py),
+            Module({ w })
+        {
+        }
+
+        Conv2D::Conv2D(const Variable& w, const Variable& b, int wx, int wy, int sx, int sy, int px, int py) :
+            m_bias(true),
+            m_wx(wx), m_wy(wy),
+            m_sx(sx), m_sy(sy),
+            m_px(px), m_py(py),
+            Module({ w, b })
+        {
+            if (b.array().dims(0) != w.array().dims(0)) {
+                throw af::exception("nn::Conv2D: Dimension mismatch between weight and bias.");
+            }
+            if (b.array().dims(1) != 1) {
+                throw af::exception("nn::Conv2D: Bias must be a vector.");
+            }
+        }
+
+        Variable Conv2D::forward(const Variable& input)
+        {
+            af::dim4 idims = input.dims();
+            int ox = outputSize(idims[0], m_wx, m_sx, m_px);
+            int oy = outputSize(idims[1], m_wy, m_sy, m_py);
+            dim_t patch = m_wx * m_wy * idims[2];
+            if (patch != m_parameters[0].dims()[1]) {
+                throw af::exception("nn::Conv2D: Input channels do not match the weight.");
+            }
+
+            // [wx * wy, ox * oy, C, N] -> [wx * wy * C, ox * oy * N]
+            auto cols = unwrap(input, m_wx, m_wy, m_sx, m_sy, m_px, m_py);
+            cols = moddims(reorder(cols, 0, 2, 1, 3), af::dim4(patch, (dim_t)ox * oy * idims[3]));
+
+            // [O, ox * oy * N] -> [ox, oy, O, N]
+            auto res = matmul(m_parameters[0], cols);
+            if (m_bias) {
+                res = broadcastAdd(res, m_parameters[1]);
+            }
+            res = moddims(res, af::dim4(res.dims()[0], ox, oy, idims[3]));
+            return reorder(res, 1, 2, 0, 3);
+        }
+
+        MaxPool2D::MaxPool2D(int wx, int wy, int sx, int sy) :
+            m_wx(wx), m_wy(wy),
+            m_sx(sx > 0 ? sx : wx), m_sy(sy > 0 ? sy : wy)
+        {
+        }
+
+        Variable MaxPool2D::forward(const Variable& input)
+        {
+            af::dim4 idims = input.dims();
+            int ox = outputSize(idims[0], m_wx, m_sx, 0);
+            int oy = outputSize(idims[1], m_wy, m_sy, 0);
+            auto cols = unwrap(input, m_wx, m_wy, m_sx, m_sy, 0, 0);
+            return moddims(reduceMax(cols, 0), af::dim4(ox, oy, idims[2], idims[3]));
+        }
+
+        AvgPool2D::AvgPool2D(int wx, int wy, int sx, int sy) :
+            m_wx(wx), m_wy(wy),
+            m_sx(sx > 0 ? sx : wx), m_sy(sy > 0 ? sy : wy)
+        {
+        }
+
+        Variable AvgPool2D::forward(const Variable& input)
+        {
+            af::dim4 idims = input.dims();
+            int ox = outputSize(idims[0], m_wx, m_sx, 0);
+            int oy = outputSize(idims[1], m_wy, m_sy, 0);
+            auto cols = unwrap(input, m_wx, m_wy, m_sx, m_sy, 0, 0);
+            auto res = sum(cols, { 0 }) * (1.0 / (m_wx * m_wy));
+            return moddims(res, af::dim4(ox, oy, idims[2], idims[3]));
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "Module.h"
+
+namespace af
+{
+    namespace nn
+    {
+        // 2-D convolution over inputs of dims [X, Y, C, N]. Patches are unwrapped
+        // (im2col) and the batch is folded into the column dimension, so the
+        // whole batch is one 2-D GEMM of the [output_channels, wx * wy * C]
+        // weight with [wx * wy * C, X' * Y' * N] columns, not a batched GEMM
+        // over N. Output dims are [X', Y', O, N].
+        class Conv2D : public Module
+        {
+        private:
+            bool m_bias;
+            int m_wx;
+            int m_wy;
+            int m_sx;
+            int m_sy;
+            int m_px;
+            int m_py;
+        public:
+            Conv2D(int input_channels, int output_channels,
+                int wx, int wy, int sx = 1, int sy = 1, int px = 0, int py = 0,
+                bool bias = true);
+
+            Conv2D(const autograd::Variable& w, int wx, int wy,
+                int sx = 1, int sy = 1, int px = 0, int py = 0);
+
+            Conv2D(const autograd::Variable& w, const autograd::Variable& b, int wx, int wy,
+                int sx = 1, int sy = 1, int px = 0, int py = 0);
+
+            autograd::Variable forward(const autograd::Variable& input);
+        };
+
+        // Pooling over [X, Y, C, N] inputs. Strides default to the window size.
+        class MaxPool2D : public Module
+        {
+        private:
+            int m_wx;
+            int m_wy;
+            int m_sx;
+            int m_sy;
+        public:
+            MaxPool2D(int wx, int wy, int sx = -1, int sy = -1);
+
+            autograd::Variable forward(const autograd::Variable& input);
+        };
+
+        class AvgPool2D : public Module
+        {
+        private:
+            int m_wx;
+            int m_wy;
+            int m_sx;
+            int m_sy;
+        public:
+            AvgPool2D(int wx, int wy, int sx = -1, int sy = -1);
+
+            autograd::Variable forward(const autograd::Variable& input);
+        };
+    }
+}
@@ -3,21 +3,66 @@
 #include "Init.h"
 #include "Dropout.h"
 
+#include <atomic>
+
 namespace af
 {
     namespace nn
     {
         using namespace autograd;
 
+        static std::atomic<unsigned long long> g_next_stream(0);
+
+        struct Stream {
+            af::randomEngine engine;
+            Dropout::RandomState state;
+        };
+
+        static Stream& threadStream()
+        {
+            static thread_local Stream stream = {
+                af::randomEngine(AF_RANDOM_ENGINE_PHILOX_4X32_10, 0), { g_next_stream++, 0 } };
+            return stream;
+        }
+
+        // Philox is counter based, so differently seeded engines give
+        // independent streams and threads never share generator state. Every
+        // call gets its own key, so a mask can be drawn again from the state
+        // alone.
+        static af::randomEngine& nextEngine()
+        {
+            Stream& stream = threadStream();
+            stream.engine.setSeed(stream.state.seed * 0x9E3779B97F4A7C15ULL + stream.state.calls++);
+            return stream.engine;
+        }
+
         Dropout::Dropout(double drop_ratio) :
             m_ratio(drop_ratio)
         {
+            if (drop_ratio < 0 || drop_ratio >= 1) {
+                throw af::exception("nn::Dropout: Ratio must be in [0, 1).");
+            }
+        }
+
+        void Dropout::setSeed(unsigned long long seed)
+        {
+            threadStream().state = { seed, 0 };
+        }
+
+        Dropout::RandomState Dropout::randomState()
+        {
+            return threadStream().state;
+        }
+
+        void Dropout::setRandomState(const RandomState& state)
+        {
+            threadStream().state = state;
         }
 
         Variable Dropout::forward(const Variable& input)
         {
             if (m_train)
-                return (uniform(input.dims(), 0.0, 1.0, f32, false) > m_ratio) * input;
+                return dropout(input, m_ratio, nextEngine());
             else
                 return input;
         }
@@ -6,13 +6,32 @@ namespace af
 {
     namespace nn
     {
+        // Inverted dropout: outputs are scaled during training so that eval is
+        // the identity. Each thread draws its masks from its own Philox stream;
+        // the mask of a forward call depends only on the stream's seed and the
+        // number of calls made on it so far.
         class Dropout : public Module
         {
         private:
             double m_ratio;
         public:
+            struct RandomState {
+                unsigned long long seed;
+                unsigned long long calls;
+            };
+
             Dropout(double drop_ratio = 0.5);
 
+            // Reseeds the calling thread's stream, e.g. for reproducible runs
+            static void setSeed(unsigned long long seed);
+
+            // Position of the calling thread's stream. Restoring a saved state
+            // makes the following forward calls draw the same masks again, which
+            // is how checkpointed segments recompute identical activations.
+            static RandomState randomState();
+
+            static void setRandomState(const RandomState& state);
+
             autograd::Variable forward(const autograd::Variable& input);
         };
     }
@@ -0,0 +1,432 @@
+#include "Functions.h"
+
+#include <utility>
+
+namespace af {
+    namespace autograd {
+
+        Variable checkpoint(const SegmentFunc_t& fn, const Variable& input,
+            const std::vector<Variable>& parameters)
+        {
+            af::array result;
+            af::array tangent;
+            {
+                NoGradGuard guard;
+                auto output = fn(input);
+                result = output.array();
+                if (output.isTangentAvailable()) {
+                    tangent = output.tangent();
+                }
+            }
+
+            std::vector<Variable> inputs;
+            inputs.reserve(parameters.size() + 1);
+            inputs.push_back(input);
+            inputs.insert(inputs.end(), parameters.begin(), parameters.end());
+
+            auto grad_func = [fn](std::vector<Variable>& inputs, const Variable& grad_output) {
+                // Recompute the segment from a detached copy of its input. The
+                // parameters are leaves of the recomputed graph, so its backward
+                // adds their gradients directly.
+                if (Variable::isGradEnabled()) {
+                    throw af::exception("checkpoint: retain_grad_graph is not supported.");
+                }
+                auto segment_input = Variable(inputs[0].array(), inputs[0].isCalcGrad());
+                Variable output;
+                {
+                    EnableGradGuard guard;
+                    output = fn(segment_input);
+                }
+                output.backward(grad_output);
+                if (segment_input.isGradAvailable()) {
+                    inputs[0].addGrad(segment_input.grad());
+                }
+            };
+            auto output = Variable(result, std::move(inputs), grad_func);
+            if (!tangent.isempty()) {
+                output.setTangent(tangent);
+            }
+            return output;
+        }
+
+        Variable jvp(const SegmentFunc_t& fn, const af::array& input, const af::array& v)
+        {
+            NoGradGuard guard;
+            auto x = Variable(input, false);
+            x.setTangent(v);
+            return fn(x);
+        }
+
+        std::vector<af::array> hvp(const Variable& loss,
+            const std::vector<Variable>& parameters,
+            const std::vector<af::array>& v)
+        {
+            if (parameters.size() != v.size()) {
+                throw af::exception("hvp: Number of parameters and directions differ.");
+            }
+
+            std::vector<Variable> params(parameters.begin(), parameters.end());
+            for (auto& param : params) {
+                param.zeroGrad();
+            }
+
+            // First pass: gradients that are themselves differentiable
+            Variable(loss).backward(true);
+
+            // Second pass: d(g . v)/dp = H v
+            Variable dot;
+            bool has_dot = false;
+            for (size_t i = 0; i < params.size(); i++) {
+                if (!params[i].isGradAvailable()) continue;
+                auto term = sum(flat(params[i].grad() * Variable(v[i], false)), { 0 });
+                dot = has_dot ? dot + term : term;
+                has_dot = true;
+            }
+
+            // The gradient graph runs through the forward nodes, which still hold
+            // their first-pass gradients.
+            for (auto& node : Variable::build(loss)) {
+                node.zeroGrad();
+            }
+            if (has_dot) {
+                dot.backward();
+            }
+
+            std::vector<af::array> result;
+            result.reserve(params.size());
+            for (auto& param : params) {
+                if (param.isGradAvailable()) {
+                    result.push_back(param.grad().array());
+                }
+                else {
+                    result.push_back(af::constant(0, param.dims(), param.type()));
+                }
+                param.zeroGrad();
+            }
+            return result;
+        }
+
+        // Recurrent tangents leave an empty array for a term that is zero, so
+        // that an operand without a tangent costs no GEMM
+        static af::array tangentOrEmpty(const Variable& var)
+        {
+            if (var.isTangentAvailable()) return var.tangent();
+            return af::array();
+        }
+
+        static void accumulate(af::array& sum, const af::array& term)
+        {
+            sum = sum.isempty() ? term : sum + term;
+        }
+
+        static af::array timestep(const af::array& seq, int t)
+        {
+            return af::array(seq(af::span, af::span, t));
+        }
+
+        static af::array gate(const af::array& gates, int k, dim_t hidden)
+        {
+            return af::array(gates(af::seq((double)(k * hidden), (double)((k + 1) * hidden - 1)), af::span));
+        }
+
+        static void setGate(af::array& seq, int k, dim_t hidden, int t, const af::array& value)
+        {
+            seq(af::seq((double)(k * hidden), (double)((k + 1) * hidden - 1)), af::span, t) = value;
+        }
+
+        // Hidden state entering every step, [h0, h_0, ..., h_{T-2}], as [H, B * T]
+        static af::array previousStates(const af::array& h0, const af::array& hs)
+        {
+            int steps = (int)hs.dims(2);
+            af::array prev = h0;
+            if (steps > 1) {
+                prev = af::join(2, h0, af::array(hs(af::span, af::span, af::seq(0, steps - 2))));
+            }
+            return af::moddims(prev, hs.dims(0), hs.dims(1) * steps);
+        }
+
+        Variable lstm(const Variable& xproj, const Variable& wh,
+            const Variable& h0, const Variable& c0)
+        {
+            const af::array& x = xproj.array();
+            const af::array& w = wh.array();
+            dim_t hidden = w.dims(1);
+            dim_t batch = x.dims(1);
+            int steps = (int)x.dims(2);
+            if (x.dims(0) != 4 * hidden || w.dims(0) != 4 * hidden) {
+                throw af::exception("lstm: Expected 4 * hidden_size gate rows.");
+            }
+
+            // Per-step activations are only kept when backward will need them
+            bool record = Variable::isGradEnabled() && (xproj.isCalcGrad() || wh.isCalcGrad() ||
+                h0.isCalcGrad() || c0.isCalcGrad());
+            af::array hs = af::constant(0, af::dim4(hidden, batch, steps), x.type());
+            af::array cs;
+            af::array acts;
+            if (record) {
+                cs = af::constant(0, af::dim4(hidden, batch, steps), x.type());
+                acts = af::constant(0, af::dim4(4 * hidden, batch, steps), x.type());
+            }
+
+            bool tangent = xproj.isTangentAvailable() || wh.isTangentAvailable() ||
+                h0.isTangentAvailable() || c0.isTangentAvailable();
+            af::array ths;
+            af::array tx = tangentOrEmpty(xproj);
+            af::array tw = tangentOrEmpty(wh);
+            af::array th = tangentOrEmpty(h0);
+            af::array tc = tangentOrEmpty(c0);
+            if (tangent) {
+                ths = af::constant(0, hs.dims(), x.type());
+            }
+
+            af::array h = h0.array();
+            af::array c = c0.array();
+            for (int t = 0; t < steps; t++) {
+                af::array z = timestep(x, t) + af::matmul(w, h);
+                af::array i = af::sigmoid(gate(z, 0, hidden));
+                af::array f = af::sigmoid(gate(z, 1, hidden));
+                af::array g = af::tanh(gate(z, 2, hidden));
+                af::array o = af::sigmoid(gate(z, 3, hidden));
+                af::array c_next = f * c + i * g;
+                af::array tanh_c = af::tanh(c_next);
+                af::array h_next = o * tanh_c;
+
+                if (tangent) {
+                    af::array tz;
+                    if (!tx.isempty()) accumulate(tz, timestep(tx, t));
+                    if (!tw.isempty()) accumulate(tz, af::matmul(tw, h));
+                    if (!th.isempty()) accumulate(tz, af::matmul(w, th));
+                    af::array tc_next;
+                    af::array th_next;
+                    if (!tc.isempty()) tc_next = f * tc;
+                    if (!tz.isempty()) {
+                        af::array ti = i * (1 - i) * gate(tz, 0, hidden);
+                        af::array tf = f * (1 - f) * gate(tz, 1, hidden);
+                        af::array tg = (1 - g * g) * gate(tz, 2, hidden);
+                        af::array to = o * (1 - o) * gate(tz, 3, hidden);
+                        accumulate(tc_next, tf * c + ti * g + i * tg);
+                        th_next = to * tanh_c;
+                    }
+                    accumulate(th_next, o * (1 - tanh_c * tanh_c) * tc_next);
+                    th = th_next;
+                    tc = tc_next;
+                    af::eval(th, tc);
+                    ths(af::span, af::span, t) = th;
+                }
+
+                if (record) {
+                    setGate(acts, 0, hidden, t, i);
+                    setGate(acts, 1, hidden, t, f);
+                    setGate(acts, 2, hidden, t, g);
+                    setGate(acts, 3, hidden, t, o);
+                    cs(af::span, af::span, t) = c_next;
+                }
+                hs(af::span, af::span, t) = h_next;
+                h = h_next;
+                c = c_next;
+                af::eval(h, c);
+            }
+
+            auto grad_func = [hs, cs, acts](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (Variable::isGradEnabled()) {
+                    throw af::exception("lstm: retain_grad_graph is not supported.");
+                }
+                const af::array& w = inputs[1].array();
+                const af::array& grad = grad_output.array();
+                dim_t hidden = hs.dims(0);
+                dim_t batch = hs.dims(1);
+                int steps = (int)hs.dims(2);
+
+                // Gradients of the pre-activation gates of every step
+                af::array dz = af::constant(0, acts.dims(), acts.type());
+                af::array dh_next = af::constant(0, hidden, batch, hs.type());
+                af::array dc_next = af::constant(0, hidden, batch, hs.type());
+                for (int t = steps - 1; t >= 0; t--) {
+                    af::array a = timestep(acts, t);
+                    af::array i = gate(a, 0, hidden);
+                    af::array f = gate(a, 1, hidden);
+                    af::array g = gate(a, 2, hidden);
+                    af::array o = gate(a, 3, hidden);
+                    af::array c_prev = t > 0 ? timestep(cs, t - 1) : inputs[3].array();
+                    af::array tanh_c = af::tanh(timestep(cs, t));
+
+                    af::array dh = timestep(grad, t) + dh_next;
+                    af::array dc = dh * o * (1 - tanh_c * tanh_c) + dc_next;
+                    setGate(dz, 0, hidden, t, dc * g * i * (1 - i));
+                    setGate(dz, 1, hidden, t, dc * c_prev * f * (1 - f));
+                    setGate(dz, 2, hidden, t, dc * i * (1 - g * g));
+                    setGate(dz, 3, hidden, t, dh * tanh_c * o * (1 - o));
+
+                    dc_next = dc * f;
+                    dh_next = af::matmulTN(w, timestep(dz, t));
+                    af::eval(dh_next, dc_next);
+                }
+
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(Variable(dz, false));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    af::array h_prev = previousStates(inputs[2].array(), hs);
+                    af::array dw = af::matmulNT(af::moddims(dz, 4 * hidden, batch * steps), h_prev);
+                    inputs[1].addGrad(Variable(dw, false));
+                }
+                if (inputs[2].isCalcGrad()) {
+                    inputs[2].addGrad(Variable(dh_next, false));
+                }
+                if (inputs[3].isCalcGrad()) {
+                    inputs[3].addGrad(Variable(dc_next, false));
+                }
+            };
+            auto output = Variable(hs, { xproj, wh, h0, c0 }, grad_func);
+            if (tangent) {
+                output.setTangent(ths);
+            }
+            return output;
+        }
+
+        Variable gru(const Variable& xproj, const Variable& wh, const Variable& bh,
+            const Variable& h0)
+        {
+            const af::array& x = xproj.array();
+            const af::array& w = wh.array();
+            dim_t hidden = w.dims(1);
+            dim_t batch = x.dims(1);
+            int steps = (int)x.dims(2);
+            if (x.dims(0) != 3 * hidden || w.dims(0) != 3 * hidden || bh.dims()[0] != 3 * hidden) {
+                throw af::exception("gru: Expected 3 * hidden_size gate rows.");
+            }
+
+            bool record = Variable::isGradEnabled() && (xproj.isCalcGrad() || wh.isCalcGrad() ||
+                bh.isCalcGrad() || h0.isCalcGrad());
+            af::array hs = af::constant(0, af::dim4(hidden, batch, steps), x.type());
+            af::array acts;
+            // Recurrent part of the new gate, which its backward needs on its own
+            af::array hns;
+            if (record) {
+                acts = af::constant(0, af::dim4(3 * hidden, batch, steps), x.type());
+                hns = af::constant(0, af::dim4(hidden, batch, steps), x.type());
+            }
+            af::array bias = af::tile(bh.array(), 1, (unsigned)batch);
+
+            bool tangent = xproj.isTangentAvailable() || wh.isTangentAvailable() ||
+                bh.isTangentAvailable() || h0.isTangentAvailable();
+            af::array ths;
+            af::array tx = tangentOrEmpty(xproj);
+            af::array tw = tangentOrEmpty(wh);
+            af::array tb = bh.isTangentAvailable() ? af::tile(bh.tangent(), 1, (unsigned)batch) : af::array();
+            af::array th = tangentOrEmpty(h0);
+            if (tangent) {
+                ths = af::constant(0, hs.dims(), x.type());
+            }
+
+            af::array h = h0.array();
+            for (int t = 0; t < steps; t++) {
+                af::array xt = timestep(x, t);
+                af::array hp = af::matmul(w, h) + bias;
+                af::array hn = gate(hp, 2, hidden);
+                af::array r = af::sigmoid(gate(xt, 0, hidden) + gate(hp, 0, hidden));
+                af::array z = af::sigmoid(gate(xt, 1, hidden) + gate(hp, 1, hidden));
+                af::array n = af::tanh(gate(xt, 2, hidden) + r * hn);
+                af::array h_next = (1 - z) * n + z * h;
+
+                if (tangent) {
+                    af::array thp;
+                    if (!tw.isempty()) accumulate(thp, af::matmul(tw, h));
+                    if (!th.isempty()) accumulate(thp, af::matmul(w, th));
+                    if (!tb.isempty()) accumulate(thp, tb);
+                    // Tangents of the reset, update and new gate pre-activations
+                    af::array ta[3];
+                    if (!tx.isempty()) {
+                        af::array txt = timestep(tx, t);
+                        for (int k = 0; k < 3; k++) {
+                            ta[k] = gate(txt, k, hidden);
+                        }
+                    }
+                    if (!thp.isempty()) {
+                        accumulate(ta[0], gate(thp, 0, hidden));
+                        accumulate(ta[1], gate(thp, 1, hidden));
+                        accumulate(ta[2], r * gate(thp, 2, hidden));
+                    }
+                    af::array th_next;
+                    if (!ta[0].isempty()) {
+                        accumulate(ta[2], r * (1 - r) * ta[0] * hn);
+                        th_next = z * (1 - z) * ta[1] * (h - n);
+                    }
+                    if (!ta[2].isempty()) accumulate(th_next, (1 - z) * (1 - n * n) * ta[2]);
+                    if (!th.isempty()) accumulate(th_next, z * th);
+                    th = th_next;
+                    th.eval();
+                    ths(af::span, af::span, t) = th;
+                }
+
+                if (record) {
+                    setGate(acts, 0, hidden, t, r);
+                    setGate(acts, 1, hidden, t, z);
+                    setGate(acts, 2, hidden, t, n);
+                    hns(af::span, af::span, t) = hn;
+                }
+                hs(af::span, af::span, t) = h_next;
+                h = h_next;
+                h.eval();
+            }
+
+            auto grad_func = [hs, acts, hns](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (Variable::isGradEnabled()) {
+                    throw af::exception("gru: retain_grad_graph is not supported.");
+                }
+                const af::array& w = inputs[1].array();
+                const af::array& grad = grad_output.array();
+                dim_t hidden = hs.dims(0);
+                dim_t batch = hs.dims(1);
+                int steps = (int)hs.dims(2);
+
+                // Gradients of the input and of the recurrent pre-activations;
+                // they differ only in the new gate, which the reset gate scales
+                af::array dx = af::constant(0, acts.dims(), acts.type());
+                af::array dhp = af::constant(0, acts.dims(), acts.type());
+                af::array dh_next = af::constant(0, hidden, batch, hs.type());
+                for (int t = steps - 1; t >= 0; t--) {
+                    af::array a = timestep(acts, t);
+                    af::array r = gate(a, 0, hidden);
+                    af::array z = gate(a, 1, hidden);
+                    af::array n = gate(a, 2, hidden);
+                    af::array h_prev = t > 0 ? timestep(hs, t - 1) : inputs[3].array();
+
+                    af::array dh = timestep(grad, t) + dh_next;
+                    af::array dn = dh * (1 - z) * (1 - n * n);
+                    af::array dr = dn * timestep(hns, t) * r * (1 - r);
+                    af::array dz = dh * (h_prev - n) * z * (1 - z);
+                    setGate(dx, 0, hidden, t, dr);
+                    setGate(dx, 1, hidden, t, dz);
+                    setGate(dx, 2, hidden, t, dn);
+                    setGate(dhp, 0, hidden, t, dr);
+                    setGate(dhp, 1, hidden, t, dz);
+                    setGate(dhp, 2, hidden, t, dn * r);
+
+                    dh_next = dh * z + af::matmulTN(w, timestep(dhp, t));
+                    dh_next.eval();
+                }
+
+                af::array dhp_flat = af::moddims(dhp, 3 * hidden, batch * steps);
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(Variable(dx, false));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    af::array h_prev = previousStates(inputs[3].array(), hs);
+                    inputs[1].addGrad(Variable(af::matmulNT(dhp_flat, h_prev), false));
+                }
+                if (inputs[2].isCalcGrad()) {
+                    inputs[2].addGrad(Variable(af::sum(dhp_flat, 1), false));
+                }
+                if (inputs[3].isCalcGrad()) {
+                    inputs[3].addGrad(Variable(dh_next, false));
+                }
+            };
+            auto output = Variable(hs, { xproj, wh, bh, h0 }, grad_func);
+            if (tangent) {
+                output.setTangent(ths);
+            }
+            return output;
+        }
+    }
+}
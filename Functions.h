@@ -1 +1,60 @@
 #pragma once
+#include "Variable.h"
+
+#include <functional>
+#include <vector>
+
+namespace af {
+    namespace autograd {
+
+        typedef std::function<Variable(const Variable&)> SegmentFunc_t;
+
+        // Gradient checkpointing: evaluates fn(input) without recording a graph
+        // and re-runs it during backward to regenerate the activations needed
+        // for the gradients. Only the segment's output is kept alive in between.
+        // parameters must list every Variable fn uses that may require a
+        // gradient; they receive their gradients from the recomputed graph.
+        // fn has to be deterministic for the gradients to match; a fn with
+        // nn::Dropout must restore Dropout::randomState() before recomputing, as
+        // nn::Sequential does.
+        // Checkpointed segments do not support retain_grad_graph.
+        Variable checkpoint(const SegmentFunc_t& fn, const Variable& input,
+            const std::vector<Variable>& parameters);
+
+        // Forward-mode Jacobian-vector product: returns fn(input), whose tangent()
+        // holds J v for the Jacobian J of fn at input. Runs in a single forward
+        // sweep under a NoGradGuard, so no graph is recorded or retained.
+        Variable jvp(const SegmentFunc_t& fn, const af::array& input, const af::array& v);
+
+        // Hessian-vector product of loss with respect to parameters, in the
+        // direction v (one array per parameter). Backpropagates once with
+        // retain_grad_graph and once more through g . v, so it costs about two
+        // backward passes and never forms the Hessian. Clears the parameters'
+        // gradients.
+        std::vector<af::array> hvp(const Variable& loss,
+            const std::vector<Variable>& parameters,
+            const std::vector<af::array>& v);
+
+        // Fused recurrent layers over a whole sequence. xproj is the input
+        // projection of every timestep, [G * H, B, T] with G gates, computed up
+        // front in one GEMM. Each step runs a single [G * H, H] x [H, B] GEMM for
+        // all gates, and the result is the hidden state of every step, [H, B, T].
+        // Backward runs through time inside one grad function and forms the
+        // recurrent weight gradient with one GEMM over all steps. The per-step
+        // gate activations that backward reads are only stored when a gradient
+        // will be taken, so inference keeps just the hidden states. Every
+        // sequence in the batch runs for all T steps; there is no length or mask
+        // handling. Pad shorter sequences at the end and ignore their padded
+        // outputs (the last step's state then includes the padding). Neither op
+        // supports retain_grad_graph.
+
+        // Gates in the order input, forget, cell, output
+        Variable lstm(const Variable& xproj, const Variable& wh,
+            const Variable& h0, const Variable& c0);
+
+        // Gates in the order reset, update, new. bh is the recurrent bias, which
+        // the new gate applies inside the reset product.
+        Variable gru(const Variable& xproj, const Variable& wh, const Variable& bh,
+            const Variable& h0);
+    }
+}
@@ -44,7 +44,145 @@ namespace af
         {
             auto res = matmul(m_parameters[0], input);
             if (m_bias) {
-                res = res + tileAs(m_parameters[1], res);
+                res = broadcastAdd(res, m_parameters[1]);
+            }
+            return res;
+        }
+
+        FusedLinear::FusedLinear(int input_size, int output_size, Activation activation, bool bias) :
+            m_bias(bias),
+            m_activation(activation)
+        {
+            auto w = nn::lecunNormal(output_size, input_size);
+            if (bias) {
+                auto b = nn::lecunNormal(output_size, 1);
+                setParams({ w, b });
+            }
+            else {
+                setParams({ w });
+            }
+        }
+
+        FusedLinear::FusedLinear(const Variable& w, Activation activation) :
+            m_bias(false),
+            m_activation(activation),
+            Module({ w })
+        {
+        }
+
+        FusedLinear::FusedLinear(const Variable& w, const Variable& b, Activation activation) :
+            m_bias(true),
+            m_activation(activation),
+            Module({ w, b })
+        {
+            if (b.array().dims(0) != w.array().dims(0)) {
+                throw af::exception("nn::FusedLinear: Dimension mismatch between weight and bias.");
+            }
+            if (b.array().dims(1) != 1) {
+                throw af::exception("nn::FusedLinear: Bias must be a vector.");
+            }
+        }
+
+        Variable FusedLinear::forward(const Variable& input)
+        {
+            if (m_bias) {
+                return linear(input, m_parameters[0], m_parameters[1], m_activation);
+            }
+            return linear(input, m_parameters[0], m_activation);
+        }
+
+        SparseLinear::SparseLinear(int input_size, int output_size, bool bias) :
+            m_bias(bias)
+        {
+            // Same distribution as Linear, stored transposed
+            auto w = nn::parameter(af::transpose(nn::lecunNormal(output_size, input_size).array()));
+            if (bias) {
+                auto b = nn::lecunNormal(output_size, 1);
+                setParams({ w, b });
+            }
+            else {
+                setParams({ w });
+            }
+        }
+
+        SparseLinear::SparseLinear(const Variable& w) :
+            m_bias(false),
+            Module({ w })
+        {
+        }
+
+        SparseLinear::SparseLinear(const Variable& w, const Variable& b) :
+            m_bias(true),
+            Module({ w, b })
+        {
+            if (b.array().dims(0) != w.array().dims(1)) {
+                throw af::exception("nn::SparseLinear: Dimension mismatch between weight and bias.");
+            }
+            if (b.array().dims(1) != 1) {
+                throw af::exception("nn::SparseLinear: Bias must be a vector.");
+            }
+        }
+
+        Variable SparseLinear::forward(const Variable& input)
+        {
+            auto in = input;
+            if (af::sparseGetStorage(input.array()) != AF_STORAGE_CSR) {
+                in = Variable(af::sparseConvertTo(input.array(), AF_STORAGE_CSR), false);
+            }
+            // [batch, input] x [input, output] -- [batch, output]
+            auto res = transpose(sparseMatmul(in, m_parameters[0], false));
+            if (m_bias) {
+                res = broadcastAdd(res, m_parameters[1]);
+            }
+            return res;
+        }
+
+        StackedLinear::StackedLinear(int input_size, int output_size, int num_models, bool bias) :
+            m_bias(bias),
+            m_num_models(num_models)
+        {
+            // Same per-member distribution as Linear, laid out side by side
+            auto w = nn::parameter(af::moddims(nn::lecunNormal(output_size, input_size * num_models).array(),
+                                               output_size, input_size, num_models));
+            if (bias) {
+                auto b = nn::parameter(af::moddims(nn::lecunNormal(output_size, num_models).array(),
+                                                   output_size, 1, num_models));
+                setParams({ w, b });
+            }
+            else {
+                setParams({ w });
+            }
+        }
+
+        StackedLinear::StackedLinear(const Variable& w) :
+            m_bias(false),
+            m_num_models((int)w.dims()[2]),
+            Module({ w })
+        {
+        }
+
+        StackedLinear::StackedLinear(const Variable& w, const Variable& b) :
+            m_bias(true),
+            m_num_models((int)w.dims()[2]),
+            Module({ w, b })
+        {
+            if (b.array().dims(0) != w.array().dims(0) || b.array().dims(2) != w.array().dims(2)) {
+                throw af::exception("nn::StackedLinear: Dimension mismatch between weight and bias.");
+            }
+            if (b.array().dims(1) != 1) {
+                throw af::exception("nn::StackedLinear: Bias must be a vector per model.");
+            }
+        }
+
+        Variable StackedLinear::forward(const Variable& input)
+        {
+            auto in = input;
+            if (m_num_models > 1 && input.dims()[2] == 1) {
+                in = tile(input, { 1, 1, m_num_models });
+            }
+            auto res = matmul(m_parameters[0], in);
+            if (m_bias) {
+                res = broadcastAdd(res, m_parameters[1]);
             }
             return res;
         }
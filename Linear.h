@@ -18,5 +18,66 @@ namespace af
 
             autograd::Variable forward(const autograd::Variable& input);
         };
+
+        // Linear followed by an activation, evaluated as one graph node with a
+        // single backward for the input, weight and bias gradients. Use in place
+        // of a Linear and activation pair in a Sequential.
+        class FusedLinear : public Module
+        {
+        private:
+            bool m_bias;
+            autograd::Activation m_activation;
+        public:
+            FusedLinear(int input_size, int output_size,
+                autograd::Activation activation = autograd::Activation::ReLU, bool bias = true);
+
+            FusedLinear(const autograd::Variable& w, autograd::Activation activation);
+
+            FusedLinear(const autograd::Variable& w, const autograd::Variable& b, autograd::Activation activation);
+
+            autograd::Variable forward(const autograd::Variable& input);
+        };
+
+        // Linear layer for sparse inputs. The input is a CSR (or COO) matrix of
+        // dims [batch, input], i.e. one row per sample, since ArrayFire only takes
+        // a sparse left operand. The weight is stored transposed, [input, output],
+        // so forward and the weight gradient are both sparse-dense products whose
+        // cost scales with the non-zeros. The output is [output, batch] as for
+        // Linear. The sparse input receives no gradient.
+        class SparseLinear : public Module
+        {
+        private:
+            bool m_bias;
+        public:
+            SparseLinear(int input_size, int output_size, bool bias = true);
+
+            SparseLinear(const autograd::Variable& w);
+
+            SparseLinear(const autograd::Variable& w, const autograd::Variable& b);
+
+            autograd::Variable forward(const autograd::Variable& input);
+        };
+
+        // N structurally identical Linear layers (an ensemble) stored as one
+        // weight of dims [output, input, N] and one bias of dims [output, 1, N].
+        // Forward is a single batched matmul over dimension 2 and the optimizers
+        // update all N members in one elementwise pass. Inputs are [input, batch, N],
+        // or [input, batch] to feed the same batch to every member. Sum the
+        // per-member losses (e.g. N * mean) so that each member gets the gradient
+        // it would get when trained alone.
+        class StackedLinear : public Module
+        {
+        private:
+            bool m_bias;
+            int m_num_models;
+        public:
+            StackedLinear(int input_size, int output_size, int num_models, bool bias = true);
+
+            StackedLinear(const autograd::Variable& w);
+
+            StackedLinear(const autograd::Variable& w, const autograd::Variable& b);
+
+            autograd::Variable forward(const autograd::Variable& input);
+        };
     }
 }
\ No newline at end of file
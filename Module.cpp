@@ -41,6 +41,15 @@ namespace af
             }
         }
 
+        void Module::cast(af::dtype type)
+        {
+            for (auto& parameter : m_parameters) {
+                parameter.zeroGrad();
+                parameter.array() = parameter.array().as(type);
+                parameter.array().eval();
+            }
+        }
+
         std::vector<Variable> Module::parameters()
         {
             return m_parameters;
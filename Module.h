@@ -29,6 +29,10 @@ namespace af
 
             void eval();
 
+            // Converts the parameters in place, e.g. to f16 for mixed precision
+            // training. Cast before handing the parameters to an optimizer.
+            void cast(af::dtype type);
+
             virtual autograd::Variable forward(const autograd::Variable& input) = 0;
 
             autograd::Variable operator()(const autograd::Variable& input);
@@ -6,4 +6,6 @@
 #include "Container.h"
 #include "Activations.h"
 #include "Loss.h"
-#include "Dropout.h"
\ No newline at end of file
+#include "Dropout.h"
+#include "Conv.h"
+#include "Recurrent.h"
\ No newline at end of file
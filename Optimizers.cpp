@@ -12,8 +12,46 @@ namespace af
     namespace optim
     {
         Optimizer::Optimizer(const vector<Variable>& parameters)
-            : m_parameters(parameters.begin(), parameters.end())
+            : m_parameters(parameters.begin(), parameters.end()),
+            m_masters(),
+            m_grad_scale(1)
         {
+            m_masters.reserve(parameters.size());
+            for (const auto& parameter : m_parameters) {
+                if (parameter.type() == f16) {
+                    m_masters.push_back(parameter.array().as(f32));
+                    m_masters.back().eval();
+                }
+                else {
+                    m_masters.push_back(af::array());
+                }
+            }
+        }
+
+        af::array& Optimizer::masterData(size_t i)
+        {
+            if (m_masters[i].isempty()) return m_parameters[i].array();
+            return m_masters[i];
+        }
+
+        af::array Optimizer::gradient(size_t i)
+        {
+            af::array grad = m_parameters[i].grad().array();
+            if (!m_masters[i].isempty()) {
+                grad = grad.as(f32);
+            }
+            if (m_grad_scale != 1) {
+                grad = grad / m_grad_scale;
+            }
+            return grad;
+        }
+
+        void Optimizer::writeBack(size_t i)
+        {
+            if (m_masters[i].isempty()) return;
+            af::array& data = m_parameters[i].array();
+            data = m_masters[i].as(data.type());
+            data.eval();
         }
 
         void Optimizer::zeroGrad()
@@ -23,6 +61,58 @@ namespace af
             }
         }
 
+        void Optimizer::setGradScale(double scale)
+        {
+            m_grad_scale = scale;
+        }
+
+        bool Optimizer::isGradFinite()
+        {
+            af::array overflow = af::constant(0, 1, b8);
+            for (auto& parameter : m_parameters) {
+                if (!parameter.isGradAvailable()) continue;
+                const af::array& grad = parameter.grad().array();
+                overflow = overflow || af::anyTrue(af::flat(af::isNaN(grad) || af::isInf(grad)));
+            }
+            return !overflow.scalar<char>();
+        }
+
+        LossScaler::LossScaler(double init_scale, double growth_factor,
+            double backoff_factor, int growth_interval)
+            : m_scale(init_scale),
+            m_growth_factor(growth_factor),
+            m_backoff_factor(backoff_factor),
+            m_growth_interval(growth_interval),
+            m_good_steps(0)
+        {
+        }
+
+        Variable LossScaler::scale(const Variable& loss) const
+        {
+            return loss * m_scale;
+        }
+
+        double LossScaler::scaleFactor() const
+        {
+            return m_scale;
+        }
+
+        bool LossScaler::step(Optimizer& optimizer)
+        {
+            if (!optimizer.isGradFinite()) {
+                m_scale *= m_backoff_factor;
+                m_good_steps = 0;
+                return false;
+            }
+            optimizer.setGradScale(m_scale);
+            optimizer.update();
+            if (++m_good_steps >= m_growth_interval) {
+                m_scale *= m_growth_factor;
+                m_good_steps = 0;
+            }
+            return true;
+        }
+
         SGDOptimizer::SGDOptimizer(const vector<Variable>& parameters,
             double learning_rate, double momentum,
             double weight_decay, bool use_nesterov)
@@ -35,8 +125,9 @@ namespace af
         {
             if (momentum != 0) {
                 m_velocities.reserve(parameters.size());
-                for (const auto& parameter : m_parameters) {
-                    m_velocities.push_back(af::constant(0, parameter.dims(), parameter.type()));
+                for (size_t i = 0; i < m_parameters.size(); i++) {
+                    const af::array& data = masterData(i);
+                    m_velocities.push_back(af::constant(0, data.dims(), data.type()));
                     m_velocities.back().eval();
                 }
             }
@@ -46,8 +137,8 @@ namespace af
         {
             for (size_t i = 0; i < m_parameters.size(); i++) {
 
-                const af::array& grad = m_parameters[i].grad().array();
-                af::array& data = m_parameters[i].array();
+                af::array grad = gradient(i);
+                af::array& data = masterData(i);
 
                 if (m_wd != 0) {
                     // Weight decay term
@@ -74,6 +165,7 @@ namespace af
                     data = data - m_lr * grad;
                     af::eval(data);
                 }
+                writeBack(i);
             }
         }
 
@@ -95,9 +187,10 @@ namespace af
             m_biased_first.reserve(parameters.size());
             m_biased_second.reserve(parameters.size());
 
-            for (const auto& parameter : m_parameters) {
-                m_biased_first.push_back(af::constant(0, parameter.dims(), parameter.type()));
-                m_biased_second.push_back(af::constant(0, parameter.dims(), parameter.type()));
+            for (size_t i = 0; i < m_parameters.size(); i++) {
+                const af::array& data = masterData(i);
+                m_biased_first.push_back(af::constant(0, data.dims(), data.type()));
+                m_biased_second.push_back(af::constant(0, data.dims(), data.type()));
 
                 m_biased_first.back().eval();
                 m_biased_second.back().eval();
@@ -107,8 +200,8 @@ namespace af
         void AdamOptimizer::update()
         {
             for (size_t i = 0; i < m_parameters.size(); i++) {
-                const af::array& grad = m_parameters[i].grad().array();
-                af::array& data = m_parameters[i].array();
+                af::array grad = gradient(i);
+                af::array& data = masterData(i);
 
                 if (m_wd != 0) {
                     // Weight decay term
@@ -130,6 +223,7 @@ namespace af
                 data = data - (corrected_lr * biased_first) / (af::sqrt(biased_second) + m_eps);
 
                 af::eval(data, biased_first, biased_second);
+                writeBack(i);
             }
         }
 
@@ -151,13 +245,14 @@ namespace af
             if (m_use_first) m_first.reserve(parameters.size());
             m_second.reserve(parameters.size());
 
-            for (const auto& parameter : m_parameters) {
+            for (size_t i = 0; i < m_parameters.size(); i++) {
+                const af::array& data = masterData(i);
                 if (m_use_first) {
-                    m_first.push_back(af::constant(0, parameter.dims(), parameter.type()));
+                    m_first.push_back(af::constant(0, data.dims(), data.type()));
                     m_first.back().eval();
                 }
 
-                m_second.push_back(af::constant(0, parameter.dims(), parameter.type()));
+                m_second.push_back(af::constant(0, data.dims(), data.type()));
                 m_second.back().eval();
             }
         }
@@ -165,8 +260,8 @@ namespace af
         void RMSPropOptimizer::update()
         {
             for (size_t i = 0; i < m_parameters.size(); i++) {
-                const af::array& grad = m_parameters[i].grad().array();
-                af::array& data = m_parameters[i].array();
+                af::array grad = gradient(i);
+                af::array& data = masterData(i);
 
                 if (m_wd != 0) {
                     // Weight decay term
@@ -193,6 +288,7 @@ namespace af
                 else {
                     af::eval(data, second);
                 }
+                writeBack(i);
             }
         }
     }
@@ -8,10 +8,24 @@ namespace af
     namespace optim
     {
 
+        // Parameters stored in f16 are updated through f32 master copies, and
+        // the optimizer state of every parameter is kept in f32 or f64.
         class Optimizer
         {
         protected:
             std::vector<autograd::Variable> m_parameters;
+            std::vector<af::array> m_masters;
+            double m_grad_scale;
+
+            // The array to update: the master copy, or the parameter itself
+            af::array& masterData(size_t i);
+
+            // The gradient in the master type with the loss scale removed
+            af::array gradient(size_t i);
+
+            // Copies an updated master back into its parameter
+            void writeBack(size_t i);
+
         public:
 
             Optimizer(const std::vector<autograd::Variable>& parameters);
@@ -19,6 +33,37 @@ namespace af
             virtual void update() = 0;
 
             void zeroGrad();
+
+            // Gradients are divided by this before being applied
+            void setGradScale(double scale);
+
+            // False if any gradient holds an inf or a NaN (a single host sync)
+            bool isGradFinite();
+        };
+
+        // Dynamic loss scaling for f16 training. Scale the loss before backward
+        // and let step() apply the update: a step with overflowed gradients is
+        // skipped and the scale backs off, and after growth_interval good steps
+        // in a row the scale grows. Compute the loss itself in f32 (see cast).
+        class LossScaler
+        {
+            double m_scale;
+            double m_growth_factor;
+            double m_backoff_factor;
+            int m_growth_interval;
+            int m_good_steps;
+        public:
+            LossScaler(double init_scale = 65536,
+                double growth_factor = 2,
+                double backoff_factor = 0.5,
+                int growth_interval = 2000);
+
+            autograd::Variable scale(const autograd::Variable& loss) const;
+
+            double scaleFactor() const;
+
+            // Returns false if the step was skipped
+            bool step(Optimizer& optimizer);
         };
 
         class SGDOptimizer : public Optimizer
@@ -0,0 +1,69 @@
+#include "Variable.h"
+
+#include "Functions.h"
+#include "Init.h"
+#include "Recurrent.h"
+
+namespace af
+{
+    namespace nn
+    {
+        using namespace autograd;
+
+        // [input, batch, T] -> [gates, batch, T] with one GEMM for all steps
+        static Variable projectSequence(const Variable& input, const Variable& w, const Variable& b)
+        {
+            af::dim4 dims = input.dims();
+            auto x = moddims(input, af::dim4(dims[0], dims[1] * dims[2]));
+            auto proj = linear(x, w, b, Activation::None);
+            return moddims(proj, af::dim4(w.dims()[0], dims[1], dims[2]));
+        }
+
+        static Variable zeroState(int hidden_size, const Variable& input)
+        {
+            return Variable(af::constant(0, hidden_size, input.dims()[1], input.type()), false);
+        }
+
+        LSTM::LSTM(int input_size, int hidden_size) :
+            m_hidden_size(hidden_size)
+        {
+            auto wx = nn::lecunNormal(4 * hidden_size, input_size);
+            auto wh = nn::lecunNormal(4 * hidden_size, hidden_size);
+            auto b = nn::lecunNormal(4 * hidden_size, 1);
+            setParams({ wx, wh, b });
+        }
+
+        Variable LSTM::forward(const Variable& input)
+        {
+            auto state = zeroState(m_hidden_size, input);
+            return forward(input, state, state);
+        }
+
+        Variable LSTM::forward(const Variable& input, const Variable& h0, const Variable& c0)
+        {
+            auto xproj = projectSequence(input, m_parameters[0], m_parameters[2]);
+            return lstm(xproj, m_parameters[1], h0, c0);
+        }
+
+        GRU::GRU(int input_size, int hidden_size) :
+            m_hidden_size(hidden_size)
+        {
+            auto wx = nn::lecunNormal(3 * hidden_size, input_size);
+            auto wh = nn::lecunNormal(3 * hidden_size, hidden_size);
+            auto bx = nn::lecunNormal(3 * hidden_size, 1);
+            auto bh = nn::lecunNormal(3 * hidden_size, 1);
+            setParams({ wx, wh, bx, bh });
+        }
+
+        Variable GRU::forward(const Variable& input)
+        {
+            return forward(input, zeroState(m_hidden_size, input));
+        }
+
+        Variable GRU::forward(const Variable& input, const Variable& h0)
+        {
+            auto xproj = projectSequence(input, m_parameters[0], m_parameters[2]);
+            return gru(xproj, m_parameters[1], m_parameters[3], h0);
+        }
+    }
+}
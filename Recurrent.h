@@ -0,0 +1,38 @@
+#pragma once
+#include "Module.h"
+
+namespace af
+{
+    namespace nn
+    {
+        // Recurrent layers over inputs of dims [input, batch, T], returning the
+        // hidden state of every step, [hidden, batch, T]. The input projection of
+        // all T steps is one GEMM; the recurrence runs as a single fused node (see
+        // autograd::lstm and autograd::gru). The state starts at zero unless given.
+        // Sequences in a batch all run for T steps, with no per-sequence lengths.
+        class LSTM : public Module
+        {
+        private:
+            int m_hidden_size;
+        public:
+            LSTM(int input_size, int hidden_size);
+
+            autograd::Variable forward(const autograd::Variable& input);
+
+            autograd::Variable forward(const autograd::Variable& input,
+                const autograd::Variable& h0, const autograd::Variable& c0);
+        };
+
+        class GRU : public Module
+        {
+        private:
+            int m_hidden_size;
+        public:
+            GRU(int input_size, int hidden_size);
+
+            autograd::Variable forward(const autograd::Variable& input);
+
+            autograd::Variable forward(const autograd::Variable& input, const autograd::Variable& h0);
+        };
+    }
+}
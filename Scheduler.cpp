@@ -0,0 +1,205 @@
+#include "Scheduler.h"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace af {
+    namespace autograd {
+
+        // The worker the calling thread runs, if it belongs to a scheduler
+        static thread_local const BackwardScheduler* t_scheduler = nullptr;
+        static thread_local unsigned t_worker = 0;
+
+        BackwardScheduler::BackwardScheduler(unsigned num_threads) :
+            m_threads(),
+            m_queues(),
+            m_queued(0),
+            m_sleeping(0),
+            m_next(0),
+            m_mutex(),
+            m_cond(),
+            m_stop(false)
+        {
+            if (num_threads == 0) num_threads = 1;
+            for (unsigned i = 0; i < num_threads; i++) {
+                m_queues.emplace_back(new Queue());
+            }
+            for (unsigned i = 0; i < num_threads; i++) {
+                m_threads.emplace_back(&BackwardScheduler::worker, this, i);
+            }
+        }
+
+        BackwardScheduler::~BackwardScheduler()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+            for (auto& thread : m_threads) {
+                thread.join();
+            }
+        }
+
+        unsigned BackwardScheduler::numThreads() const
+        {
+            return (unsigned)m_threads.size();
+        }
+
+        void BackwardScheduler::push(Task_t task)
+        {
+            unsigned target = t_scheduler == this
+                ? t_worker
+                : m_next.fetch_add(1) % (unsigned)m_queues.size();
+            // Counted before it is queued, so m_queued never drops below the
+            // number of tasks a worker could find
+            m_queued.fetch_add(1);
+            {
+                Queue& queue = *m_queues[target];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+            // Paired with the sleeping count in worker: either the sleeper sees
+            // the new task before it waits, or it is woken here.
+            if (m_sleeping.load() > 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cond.notify_one();
+            }
+        }
+
+        bool BackwardScheduler::pop(unsigned self, Task_t& task)
+        {
+            unsigned count = (unsigned)m_queues.size();
+            for (unsigned k = 0; k < count; k++) {
+                unsigned i = (self + k) % count;
+                Queue& queue = *m_queues[i];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+                if (i == self) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+                else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                m_queued.fetch_sub(1);
+                return true;
+            }
+            return false;
+        }
+
+        void BackwardScheduler::worker(unsigned self)
+        {
+            t_scheduler = this;
+            t_worker = self;
+            while (true) {
+                Task_t task;
+                if (pop(self, task)) {
+                    task();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_sleeping.fetch_add(1);
+                m_cond.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+                m_sleeping.fetch_sub(1);
+                if (m_stop && m_queued.load() == 0) return;
+            }
+        }
+
+        namespace {
+            struct Run {
+                Variable::DAG_t dag;
+                std::vector<std::vector<int>> inputs;
+                std::unique_ptr<std::atomic<int>[]> pending;
+                std::atomic<size_t> remaining;
+                std::exception_ptr error;
+                std::mutex mutex;
+                std::condition_variable done;
+                bool retain_grad_graph;
+                bool release_graph;
+            };
+        }
+
+        void BackwardScheduler::backward(const Variable& root, const Variable& grad,
+            bool retain_grad_graph, bool release_graph)
+        {
+            Run run;
+            run.dag = Variable::build(root);
+            run.retain_grad_graph = retain_grad_graph;
+            run.release_graph = release_graph;
+
+            size_t count = run.dag.size();
+            std::unordered_map<std::ptrdiff_t, int> index;
+            for (size_t i = 0; i < count; i++) {
+                index[run.dag[i].id()] = (int)i;
+            }
+
+            // Count one dependency per edge, so that a node used twice by the same
+            // consumer (e.g. x * x) is released once both uses are done.
+            run.inputs.resize(count);
+            run.pending.reset(new std::atomic<int>[count]);
+            for (size_t i = 0; i < count; i++) {
+                run.pending[i] = 0;
+            }
+            for (size_t i = 0; i < count; i++) {
+                for (const auto& input : run.dag[i].getInputs()) {
+                    int j = index[input.id()];
+                    run.inputs[i].push_back(j);
+                    run.pending[j]++;
+                }
+            }
+            run.remaining = count;
+
+            Variable(root).addGrad(grad);
+
+            std::function<void(int)> process = [this, &run, &process](int i) {
+                try {
+                    run.dag[i].calcGradInputs(run.retain_grad_graph);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(run.mutex);
+                    if (!run.error) run.error = std::current_exception();
+                }
+                if (run.release_graph) {
+                    // Its consumers are done and its inputs are only reached
+                    // through run.inputs, so no other worker touches this node.
+                    Variable var = std::move(run.dag[i]);
+                    var.releaseGraph();
+                }
+                for (int j : run.inputs[i]) {
+                    if (--run.pending[j] == 0) {
+                        push([&process, j] { process(j); });
+                    }
+                }
+                // Decrement under the lock: the caller may destroy run as soon as
+                // it observes zero.
+                std::lock_guard<std::mutex> lock(run.mutex);
+                if (--run.remaining == 0) {
+                    run.done.notify_all();
+                }
+            };
+
+            // The root is the only node without consumers
+            push([&process, count] { process((int)count - 1); });
+
+            {
+                std::unique_lock<std::mutex> lock(run.mutex);
+                run.done.wait(lock, [&run] { return run.remaining == 0; });
+            }
+
+            if (run.error) {
+                std::rethrow_exception(run.error);
+            }
+        }
+
+        void BackwardScheduler::backward(const Variable& root, bool retain_grad_graph, bool release_graph)
+        {
+            auto ones = Variable(af::constant(1, root.dims()), false);
+            this->backward(root, ones, retain_grad_graph, release_graph);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "Variable.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace af {
+    namespace autograd {
+
+        // Runs backward over a thread pool. Each node counts the consumers whose
+        // gradients it still waits for, and it becomes ready once that count
+        // reaches zero. Independent branches (multi-head outputs, ensembles,
+        // separate loss terms) are therefore processed concurrently. The
+        // gradients match the serial Variable::backward up to the order in
+        // which a node's incoming gradients are summed.
+        //
+        // Every worker owns a deque. Nodes made ready by a worker go to the back
+        // of its own deque and it takes work from there (depth first, so the
+        // gradients it just produced are consumed while hot); idle workers steal
+        // from the front of the others'. The shared mutex is only taken to put
+        // a worker to sleep or wake one.
+        class BackwardScheduler
+        {
+        private:
+            typedef std::function<void()> Task_t;
+
+            struct Queue {
+                std::deque<Task_t> tasks;
+                std::mutex mutex;
+            };
+
+            std::vector<std::thread> m_threads;
+            std::vector<std::unique_ptr<Queue>> m_queues;
+            std::atomic<size_t> m_queued;
+            std::atomic<unsigned> m_sleeping;
+            std::atomic<unsigned> m_next;
+            std::mutex m_mutex;
+            std::condition_variable m_cond;
+            bool m_stop;
+
+            void push(Task_t task);
+
+            bool pop(unsigned self, Task_t& task);
+
+            void worker(unsigned self);
+
+            BackwardScheduler(const BackwardScheduler&) = delete;
+            BackwardScheduler& operator=(const BackwardScheduler&) = delete;
+
+        public:
+            BackwardScheduler(unsigned num_threads = std::thread::hardware_concurrency());
+
+            ~BackwardScheduler();
+
+            unsigned numThreads() const;
+
+            // release_graph drops each node's inputs and grad function once its
+            // gradients have been passed on, as Variable::backward does.
+            void backward(const Variable& root, const Variable& grad,
+                bool retain_grad_graph = false, bool release_graph = false);
+
+            void backward(const Variable& root, bool retain_grad_graph = false, bool release_graph = false);
+        };
+    }
+}
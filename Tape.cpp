@@ -0,0 +1,143 @@
+#include "Tape.h"
+
+#include <atomic>
+#include <unordered_map>
+#include <utility>
+
+namespace af {
+    namespace autograd {
+
+        static std::atomic<unsigned long> g_tape_stamp(0);
+
+        Tape::Tape() :
+            m_entries(),
+            m_edges(),
+            m_order(),
+            m_nodes(),
+            m_captures(0)
+        {}
+
+        bool Tape::isCaptured() const
+        {
+            return !m_entries.empty();
+        }
+
+        unsigned Tape::captures() const
+        {
+            return m_captures;
+        }
+
+        void Tape::reset()
+        {
+            m_entries.clear();
+            m_edges.clear();
+            m_order.clear();
+            m_nodes.clear();
+        }
+
+        void Tape::capture(const Variable& root)
+        {
+            reset();
+            m_captures++;
+
+            // Same post-order walk as Variable::build, additionally recording how
+            // every node was reached so that replay() can follow the same path.
+            std::unordered_map<std::ptrdiff_t, int> cache;
+            std::vector<std::pair<int, size_t>> stack;
+
+            cache[root.id()] = 0;
+            m_entries.push_back({ -1, -1, (int)root.getInputs().size(), root.dims() });
+            m_nodes.push_back(root);
+            stack.emplace_back(0, 0);
+
+            while (!stack.empty()) {
+                auto& top = stack.back();
+                int parent = top.first;
+                auto& inputs = m_nodes[parent].getInputs();
+                if (top.second < inputs.size()) {
+                    int slot = (int)top.second++;
+                    const Variable& input = inputs[slot];
+                    auto found = cache.find(input.id());
+                    if (found != cache.end()) {
+                        m_edges.push_back({ parent, slot, found->second });
+                        continue;
+                    }
+                    int node = (int)m_entries.size();
+                    cache[input.id()] = node;
+                    m_entries.push_back({ parent, slot, (int)input.getInputs().size(), input.dims() });
+                    m_nodes.push_back(input);
+                    stack.emplace_back(node, 0);
+                }
+                else {
+                    m_order.push_back(parent);
+                    stack.pop_back();
+                }
+            }
+        }
+
+        bool Tape::replay(const Variable& root)
+        {
+            if (m_entries.empty()) return false;
+
+            // Every node gets this stamp when first reached, so a graph that shares
+            // nodes differently from the recorded one is detected without hashing.
+            unsigned long stamp = ++g_tape_stamp;
+
+            m_nodes.clear();
+            for (size_t i = 0; i < m_entries.size(); i++) {
+                const Entry& entry = m_entries[i];
+                const Variable* node = &root;
+                if (entry.parent >= 0) {
+                    auto& inputs = m_nodes[entry.parent].getInputs();
+                    if ((size_t)entry.slot >= inputs.size()) return false;
+                    node = &inputs[entry.slot];
+                }
+                if (node->m_shared->m_tape_stamp == stamp ||
+                    node->getInputs().size() != (size_t)entry.num_inputs ||
+                    node->dims() != entry.dims) {
+                    return false;
+                }
+                node->m_shared->m_tape_stamp = stamp;
+                m_nodes.push_back(*node);
+            }
+
+            for (const auto& edge : m_edges) {
+                auto& inputs = m_nodes[edge.parent].getInputs();
+                if ((size_t)edge.slot >= inputs.size() ||
+                    inputs[edge.slot].id() != m_nodes[edge.node].id()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void Tape::backward(const Variable& root, const Variable& grad,
+            bool retain_grad_graph, bool release_graph)
+        {
+            if (!replay(root)) {
+                capture(root);
+            }
+
+            Variable(root).addGrad(grad);
+            for (auto iter = m_order.rbegin(); iter != m_order.rend(); iter++) {
+                if (release_graph) {
+                    Variable var = std::move(m_nodes[*iter]);
+                    var.calcGradInputs(retain_grad_graph);
+                    var.releaseGraph();
+                }
+                else {
+                    m_nodes[*iter].calcGradInputs(retain_grad_graph);
+                }
+            }
+
+            // Keep the recorded schedule and the capacity, but not the graph itself.
+            m_nodes.clear();
+        }
+
+        void Tape::backward(const Variable& root, bool retain_grad_graph, bool release_graph)
+        {
+            auto ones = Variable(af::constant(1, root.dims()), false);
+            this->backward(root, ones, retain_grad_graph, release_graph);
+        }
+    }
+}
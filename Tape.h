@@ -0,0 +1,56 @@
+#pragma once
+#include "Variable.h"
+
+#include <vector>
+
+namespace af {
+    namespace autograd {
+
+        // Records the backward schedule of a graph once and replays it on later
+        // iterations that rebuild a graph of the same structure (e.g. a training
+        // loop over nn::Sequential). Replaying walks the new graph along the
+        // recorded input slots, so it needs neither hashing nor recursion. The
+        // tape is captured again whenever structure or shapes change.
+        class Tape
+        {
+        private:
+            struct Entry {
+                int parent;
+                int slot;
+                int num_inputs;
+                af::dim4 dims;
+            };
+
+            struct Edge {
+                int parent;
+                int slot;
+                int node;
+            };
+
+            std::vector<Entry> m_entries;
+            std::vector<Edge> m_edges;
+            std::vector<int> m_order;
+            std::vector<Variable> m_nodes;
+            unsigned m_captures;
+
+            void capture(const Variable& root);
+
+            bool replay(const Variable& root);
+
+        public:
+            Tape();
+
+            bool isCaptured() const;
+
+            unsigned captures() const;
+
+            void reset();
+
+            void backward(const Variable& root, const Variable& grad,
+                bool retain_grad_graph = false, bool release_graph = false);
+
+            void backward(const Variable& root,
+                bool retain_grad_graph = false, bool release_graph = false);
+        };
+    }
+}
@@ -1,13 +1,176 @@
 #include "Variable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+
 namespace af {
     namespace autograd {
-        
+
+        static thread_local bool t_grad_enabled = true;
+
+        static std::atomic<unsigned> g_max_jit_depth(0);
+        static std::atomic<size_t> g_max_jit_nodes(0);
+        static std::atomic<bool> g_eval_saved_outputs(true);
+        static std::atomic<size_t> g_evals(0);
+        static std::atomic<size_t> g_policy_evals(0);
+        static std::atomic<size_t> g_jit_nodes(0);
+
+        // Node counts add up the counts of all inputs, so an expression that
+        // reuses a subtree is counted more than once. Saturate rather than wrap.
+        static const size_t max_tracked_jit_nodes = (size_t)1 << 30;
+
+        static void evalArray(af::array& arr, size_t jit_nodes)
+        {
+            arr.eval();
+            g_evals.fetch_add(1, std::memory_order_relaxed);
+            g_jit_nodes.fetch_add(jit_nodes, std::memory_order_relaxed);
+        }
+
+        static bool exceedsEvalPolicy(unsigned jit_depth, size_t jit_nodes)
+        {
+            unsigned max_depth = g_max_jit_depth.load(std::memory_order_relaxed);
+            size_t max_nodes = g_max_jit_nodes.load(std::memory_order_relaxed);
+            return (max_depth > 0 && jit_depth >= max_depth) || (max_nodes > 0 && jit_nodes >= max_nodes);
+        }
+
+        // Depth and node count of the gradient whose grad function is running on
+        // this thread. Grad functions wrap their lazy results as Variable(expr,
+        // false), which cannot see the expressions they were built from, so they
+        // are counted one node deeper than this. Arrays ArrayFire has already
+        // evaluated are over-counted, which at worst costs an eval() that does
+        // nothing.
+        struct GradJit {
+            bool active;
+            unsigned depth;
+            size_t nodes;
+        };
+
+        static thread_local GradJit t_grad_jit = { false, 0, 0 };
+
+        struct GradJitScope {
+            GradJit prev;
+
+            GradJitScope(const GradJit& jit) : prev(t_grad_jit) { t_grad_jit = jit; }
+
+            ~GradJitScope() { t_grad_jit = prev; }
+        };
+
+        // Gradients may be added to a node from several threads during a parallel
+        // backward pass. Nodes are mapped onto a fixed set of locks so that Shared
+        // does not have to carry a mutex of its own.
+        static std::mutex g_grad_locks[64];
+
+        static std::mutex& gradLock(const void* shared)
+        {
+            return g_grad_locks[((size_t)shared >> 4) % 64];
+        }
+
+        // Every op allocates one graph node and most of them die with the
+        // iteration that created them. Nodes (control block and Shared in a
+        // single block, via allocate_shared) are therefore recycled through a
+        // per-thread free list, so steady-state training does not hit malloc
+        // for them. Blocks freed on another thread join that thread's list.
+        // Only the node itself is pooled: the m_inputs vector is still a heap
+        // allocation, and so is any grad closure that captures an af::array or
+        // a std::vector (saved outputs, packed masks, indices), since those are
+        // too large or not trivially copyable for std::function's local buffer.
+        //
+        // This is an allocator change only. Grad functions stay std::function
+        // closures over a std::vector<Variable>, because GradFunc_t is how user
+        // code defines its own ops; an op-kind enum with inline input slots would
+        // break it. Nodes are not arena-allocated either, since a node can
+        // outlive its iteration (a kept model output, a retained grad graph).
+        // Reference counts stay atomic, as BackwardScheduler shares nodes
+        // between threads.
+        template<typename T>
+        class NodeAllocator
+        {
+        private:
+            struct Block {
+                Block* next;
+            };
+
+            struct FreeList {
+                Block* head;
+                size_t size;
+                bool closed;
+
+                ~FreeList()
+                {
+                    closed = true;
+                    while (head) {
+                        Block* next = head->next;
+                        ::operator delete(head);
+                        head = next;
+                    }
+                }
+            };
+
+            static const size_t block_size = sizeof(T) > sizeof(Block) ? sizeof(T) : sizeof(Block);
+            static const size_t max_cached = 1 << 16;
+
+            static FreeList& freeList()
+            {
+                static thread_local FreeList list = { nullptr, 0, false };
+                return list;
+            }
+
+        public:
+            typedef T value_type;
+
+            NodeAllocator() {}
+
+            template<typename U>
+            NodeAllocator(const NodeAllocator<U>&) {}
+
+            T* allocate(size_t n)
+            {
+                FreeList& list = freeList();
+                if (n != 1 || !list.head) {
+                    return static_cast<T*>(::operator new(n * block_size));
+                }
+                Block* block = list.head;
+                list.head = block->next;
+                list.size--;
+                return reinterpret_cast<T*>(block);
+            }
+
+            void deallocate(T* ptr, size_t n)
+            {
+                FreeList& list = freeList();
+                if (n != 1 || list.closed || list.size >= max_cached) {
+                    ::operator delete(ptr);
+                    return;
+                }
+                Block* block = reinterpret_cast<Block*>(ptr);
+                block->next = list.head;
+                list.head = block;
+                list.size++;
+            }
+        };
+
+        template<typename T, typename U>
+        bool operator ==(const NodeAllocator<T>&, const NodeAllocator<U>&) { return true; }
+
+        template<typename T, typename U>
+        bool operator !=(const NodeAllocator<T>&, const NodeAllocator<U>&) { return false; }
+
         Variable::Shared::Shared() :
             m_calc_grad(true),
             m_data(),
             m_inputs(),
             m_grads(),
-            m_grad_func(nullptr)
+            m_grad_owned(false),
+            m_grad_func(nullptr),
+            m_tangent(),
+            m_tape_stamp(0),
+            m_jit_depth(0),
+            m_jit_nodes(0),
+            m_tangent_jit_depth(0),
+            m_tangent_jit_nodes(0)
         {}
 
         Variable::Shared::Shared(const af::array& data, bool calc_grad) :
@@ -15,36 +178,89 @@ namespace af {
             m_data(data),
             m_inputs(),
             m_grads(),
-            m_grad_func(nullptr)
+            m_grad_owned(false),
+            m_grad_func(nullptr),
+            m_tangent(),
+            m_tape_stamp(0),
+            m_jit_depth(0),
+            m_jit_nodes(0),
+            m_tangent_jit_depth(0),
+            m_tangent_jit_nodes(0)
         {}
 
-        Variable::Shared::Shared(const af::array& data, const std::vector<Variable>& inputs, GradFunc_t grad_func, bool calc_grad) :
+        Variable::Shared::Shared(const af::array& data, std::vector<Variable>&& inputs, GradFunc_t&& grad_func, bool calc_grad) :
             m_calc_grad(calc_grad),
             m_data(data),
-            m_inputs(inputs.begin(), inputs.end()),
+            m_inputs(std::move(inputs)),
             m_grads(),
-            m_grad_func(grad_func)
+            m_grad_owned(false),
+            m_grad_func(std::move(grad_func)),
+            m_tangent(),
+            m_tape_stamp(0),
+            m_jit_depth(0),
+            m_jit_nodes(0),
+            m_tangent_jit_depth(0),
+            m_tangent_jit_nodes(0)
         {}
 
         Variable::Variable() :
-            m_shared(new Shared()) {}
+            m_shared(std::allocate_shared<Shared>(NodeAllocator<Shared>())) {}
 
         Variable::Variable(const af::array& data, bool calc_grad) :
-            m_shared(new Shared(data, calc_grad)) {}
+            m_shared(std::allocate_shared<Shared>(NodeAllocator<Shared>(), data, calc_grad))
+        {
+            if (t_grad_jit.active) {
+                m_shared->m_jit_depth = t_grad_jit.depth + 1;
+                m_shared->m_jit_nodes = std::min(t_grad_jit.nodes + 1, max_tracked_jit_nodes);
+                applyEvalPolicy();
+            }
+        }
+
+        Variable::Variable(const af::array& data, std::vector<Variable> inputs, GradFunc_t grad_func) :
+            Variable(data, std::move(inputs), std::move(grad_func), false)
+        {
+        }
 
-        Variable::Variable(const af::array& data, const std::vector<Variable>& inputs, GradFunc_t grad_func) :
+        Variable::Variable(const af::array& data, std::vector<Variable> inputs, GradFunc_t grad_func, bool evaluated) :
             m_shared(nullptr)
         {
             bool calc_grad = false;
+            unsigned jit_depth = 0;
+            size_t jit_nodes = 0;
+            unsigned tangent_jit_depth = 0;
+            size_t tangent_jit_nodes = 0;
             for (const auto& input : inputs) {
                 calc_grad |= input.isCalcGrad();
+                jit_depth = std::max(jit_depth, input.m_shared->m_jit_depth);
+                jit_nodes += input.m_shared->m_jit_nodes;
+                tangent_jit_depth = std::max(tangent_jit_depth, input.m_shared->m_tangent_jit_depth);
+                tangent_jit_nodes += input.m_shared->m_tangent_jit_nodes;
             }
-            if (calc_grad) {
-                m_shared = std::shared_ptr<Shared>(new Shared(data, inputs, grad_func, true));
+            if (calc_grad && t_grad_enabled) {
+                m_shared = std::allocate_shared<Shared>(NodeAllocator<Shared>(),
+                    data, std::move(inputs), std::move(grad_func), true);
             }
             else {
-                m_shared = std::shared_ptr<Shared>(new Shared(data, false));
+                m_shared = std::allocate_shared<Shared>(NodeAllocator<Shared>(), data, false);
             }
+            // Used by setTangent if the op propagates a tangent
+            m_shared->m_tangent_jit_depth = tangent_jit_depth + 1;
+            m_shared->m_tangent_jit_nodes = std::min(tangent_jit_nodes + 1, max_tracked_jit_nodes);
+            if (!evaluated) {
+                m_shared->m_jit_depth = jit_depth + 1;
+                m_shared->m_jit_nodes = std::min(jit_nodes + 1, max_tracked_jit_nodes);
+                applyEvalPolicy();
+            }
+        }
+
+        void Variable::applyEvalPolicy()
+        {
+            if (!exceedsEvalPolicy(m_shared->m_jit_depth, m_shared->m_jit_nodes)) return;
+
+            evalArray(m_shared->m_data, m_shared->m_jit_nodes);
+            g_policy_evals.fetch_add(1, std::memory_order_relaxed);
+            m_shared->m_jit_depth = 0;
+            m_shared->m_jit_nodes = 0;
         }
 
         af::array& Variable::array()const
@@ -77,6 +293,33 @@ namespace af {
             return m_shared->m_calc_grad;
         }
 
+        af::array& Variable::tangent() const
+        {
+            if (m_shared->m_tangent.isempty()) {
+                throw af::exception("Tangent hasn't been set or propagated.");
+            }
+            return m_shared->m_tangent;
+        }
+
+        bool Variable::isTangentAvailable() const
+        {
+            return !m_shared->m_tangent.isempty();
+        }
+
+        void Variable::setTangent(const af::array& tangent)
+        {
+            if (tangent.dims() != this->dims()) {
+                throw af::exception("Variable::setTangent: Tangent and data dimensions differ.");
+            }
+            m_shared->m_tangent = tangent;
+            if (exceedsEvalPolicy(m_shared->m_tangent_jit_depth, m_shared->m_tangent_jit_nodes)) {
+                evalArray(m_shared->m_tangent, m_shared->m_tangent_jit_nodes);
+                g_policy_evals.fetch_add(1, std::memory_order_relaxed);
+                m_shared->m_tangent_jit_depth = 0;
+                m_shared->m_tangent_jit_nodes = 0;
+            }
+        }
+
         bool Variable::isGradAvailable() const
         {
             if (!m_shared->m_calc_grad) return false;
@@ -96,6 +339,7 @@ namespace af {
         void Variable::zeroGrad()
         {
             m_shared->m_grads.clear();
+            m_shared->m_grad_owned = false;
         }
 
         void Variable::setCalcGrad(bool calc_grad)
@@ -110,9 +354,64 @@ namespace af {
 
         void Variable::addGrad(const Variable& child_grad)
         {
-            if (m_shared->m_calc_grad) {
-                m_shared->m_grads.push_back(child_grad);
+            if (!m_shared->m_calc_grad) return;
+
+            std::lock_guard<std::mutex> lock(gradLock(m_shared.get()));
+            auto& grads = m_shared->m_grads;
+            if (grads.empty()) {
+                // The first gradient is stored as is. It may be shared with other
+                // nodes (e.g. both inputs of operator+), so it is never modified.
+                grads.push_back(child_grad);
+                m_shared->m_grad_owned = false;
+                return;
+            }
+
+            // Later gradients are summed into a buffer owned by this node, which
+            // releases each incoming gradient as soon as it has been added. A
+            // gradient graph that is being retained is summed through autograd.
+            Variable& grad = grads[0];
+            if (t_grad_enabled && (grad.isCalcGrad() || child_grad.isCalcGrad())) {
+                grad = grad + child_grad;
+                m_shared->m_grad_owned = false;
+            }
+            else if (m_shared->m_grad_owned) {
+                grad.array() += child_grad.array();
+                evalArray(grad.array(), child_grad.m_shared->m_jit_nodes + 1);
+            }
+            else {
+                size_t jit_nodes = grad.m_shared->m_jit_nodes + child_grad.m_shared->m_jit_nodes + 1;
+                grad = Variable(grad.array() + child_grad.array(), false);
+                evalArray(grad.array(), jit_nodes);
+                grad.m_shared->m_jit_depth = 0;
+                grad.m_shared->m_jit_nodes = 0;
+                m_shared->m_grad_owned = true;
+            }
+        }
+
+        void Variable::addGrad(const af::array& grad, int dim, const af::index& idx)
+        {
+            if (!m_shared->m_calc_grad) return;
+
+            af::index ix[4] = { af::span, af::span, af::span, af::span };
+            ix[dim] = idx;
+
+            std::lock_guard<std::mutex> lock(gradLock(m_shared.get()));
+            auto& grads = m_shared->m_grads;
+            if (grads.empty() || !m_shared->m_grad_owned) {
+                // Every later region lands in this buffer, so a node that is
+                // sliced many times allocates its full gradient once.
+                af::array buffer = grads.empty()
+                    ? af::constant(0, this->dims(), this->type())
+                    : grads[0].array().copy();
+                grads.clear();
+                grads.push_back(Variable(buffer, false));
+                m_shared->m_grad_owned = true;
             }
+            af::array& buffer = grads[0].array();
+            buffer(ix[0], ix[1], ix[2], ix[3]) += grad;
+            evalArray(buffer, 1);
+            grads[0].m_shared->m_jit_depth = 0;
+            grads[0].m_shared->m_jit_nodes = 0;
         }
 
         void Variable::evalGrad(bool retain_grad_graph)
@@ -120,41 +419,259 @@ namespace af {
             // Flag asking not to calculate gradients
             if (!m_shared->m_calc_grad) return;
 
-            // Best not to evaluate the JIT immediately if theres only a single gradient
-            Variable grad = m_shared->m_grads[0];
-            if (m_shared->m_grads.size() > 1) {
-                for (unsigned i = 1; i < m_shared->m_grads.size(); i++) {
-                    grad = grad + m_shared->m_grads[i];
-                }
-                grad.array().eval();
-                m_shared->m_grads.resize(1);
+            // Gradients are summed into m_grads[0] as they arrive in addGrad. The
+            // gradient may be shared with a node evaluated on another thread.
+            Variable& grad = m_shared->m_grads[0];
+            std::lock_guard<std::mutex> lock(gradLock(grad.m_shared.get()));
+            if (!retain_grad_graph && grad.isCalcGrad()) {
+                grad.setCalcGrad(false);
             }
-
-            grad.setCalcGrad(retain_grad_graph);
-            m_shared->m_grads[0] = grad;
         }
 
         void Variable::calcGradInputs(bool retain_grad_graph)
         {
-            evalGrad();
-            if (m_shared->m_grad_func) {
-                m_shared->m_grad_func(m_shared->m_inputs, m_shared->m_grads[0]);
+            // Nothing reached this node, e.g. all its consumers skipped it
+            if (m_shared->m_grads.empty()) return;
+            evalGrad(retain_grad_graph);
+            if (!m_shared->m_grad_func) return;
+
+            const Variable& grad = m_shared->m_grads[0];
+            GradJitScope scope({ true, grad.m_shared->m_jit_depth, grad.m_shared->m_jit_nodes });
+
+            // Only a retained gradient graph needs the grad function's ops recorded
+            if (retain_grad_graph) {
+                EnableGradGuard guard;
+                m_shared->m_grad_func(m_shared->m_inputs, grad);
+            }
+            else {
+                NoGradGuard guard;
+                m_shared->m_grad_func(m_shared->m_inputs, grad);
             }
         }
 
-        void Variable::backward(const Variable& grad, bool retain_grad_graph)
+        void Variable::releaseGraph()
+        {
+            // Leaf Variables keep their gradients. Evaluate them so that a lazy
+            // gradient does not keep the activations it was computed from alive.
+            if (!m_shared->m_grad_func) {
+                if (!m_shared->m_grads.empty()) {
+                    // The gradient may be shared with a leaf released on another thread
+                    Variable& grad = m_shared->m_grads[0];
+                    std::lock_guard<std::mutex> lock(gradLock(grad.m_shared.get()));
+                    evalArray(grad.array(), grad.m_shared->m_jit_nodes);
+                    grad.m_shared->m_jit_depth = 0;
+                    grad.m_shared->m_jit_nodes = 0;
+                }
+                return;
+            }
+            m_shared->m_grad_func = nullptr;
+            m_shared->m_inputs.clear();
+            m_shared->m_grads.clear();
+            m_shared->m_grad_owned = false;
+        }
+
+        void Variable::run(DAG_t& dag, bool retain_grad_graph, bool release_graph)
         {
-            this->addGrad(grad);
-            Variable::DAG_t dag = Variable::build(*this);
             for (auto iter = dag.rbegin(); iter != dag.rend(); iter++) {
-                iter->calcGradInputs(retain_grad_graph);
+                if (release_graph) {
+                    // Drop the DAG's reference too, so that the node's data is freed
+                    // as soon as nothing outside the graph holds on to it.
+                    Variable var = std::move(*iter);
+                    var.calcGradInputs(retain_grad_graph);
+                    var.releaseGraph();
+                }
+                else {
+                    iter->calcGradInputs(retain_grad_graph);
+                }
             }
         }
 
-        void Variable::backward(bool retain_grad_graph)
+        void Variable::backward(const Variable& grad, bool retain_grad_graph, bool release_graph)
+        {
+            this->addGrad(grad);
+            Variable::DAG_t dag = Variable::build(*this);
+            Variable::run(dag, retain_grad_graph, release_graph);
+        }
+
+        void Variable::backward(bool retain_grad_graph, bool release_graph)
         {
             auto ones = Variable(af::constant(1, this->dims()), false);
-            this->backward(ones, retain_grad_graph);
+            this->backward(ones, retain_grad_graph, release_graph);
+        }
+
+        void Variable::backward(const std::vector<Variable>& roots,
+            const std::vector<Variable>& grads,
+            bool retain_grad_graph, bool release_graph)
+        {
+            if (roots.size() != grads.size()) {
+                throw af::exception("Variable::backward: Number of roots and gradients differ.");
+            }
+            for (size_t i = 0; i < roots.size(); i++) {
+                Variable(roots[i]).addGrad(grads[i]);
+            }
+            Variable::DAG_t dag = Variable::build(roots);
+            Variable::run(dag, retain_grad_graph, release_graph);
+        }
+
+        void Variable::backward(const std::vector<Variable>& roots,
+            bool retain_grad_graph, bool release_graph)
+        {
+            std::vector<Variable> grads;
+            grads.reserve(roots.size());
+            for (const auto& root : roots) {
+                grads.push_back(Variable(af::constant(1, root.dims()), false));
+            }
+            Variable::backward(roots, grads, retain_grad_graph, release_graph);
+        }
+
+        bool Variable::isGradEnabled()
+        {
+            return t_grad_enabled;
+        }
+
+        EvalPolicy::EvalPolicy(unsigned max_depth, size_t max_nodes, bool eval_saved_outputs) :
+            max_depth(max_depth),
+            max_nodes(max_nodes),
+            eval_saved_outputs(eval_saved_outputs)
+        {
+        }
+
+        void Variable::setEvalPolicy(const EvalPolicy& policy)
+        {
+            g_max_jit_depth.store(policy.max_depth, std::memory_order_relaxed);
+            g_max_jit_nodes.store(policy.max_nodes, std::memory_order_relaxed);
+            g_eval_saved_outputs.store(policy.eval_saved_outputs, std::memory_order_relaxed);
+        }
+
+        EvalPolicy Variable::evalPolicy()
+        {
+            return EvalPolicy(g_max_jit_depth.load(std::memory_order_relaxed),
+                g_max_jit_nodes.load(std::memory_order_relaxed),
+                g_eval_saved_outputs.load(std::memory_order_relaxed));
+        }
+
+        EvalStats Variable::evalStats()
+        {
+            EvalStats stats;
+            stats.evals = g_evals.load(std::memory_order_relaxed);
+            stats.policy_evals = g_policy_evals.load(std::memory_order_relaxed);
+            stats.jit_nodes = g_jit_nodes.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        void Variable::resetEvalStats()
+        {
+            g_evals.store(0, std::memory_order_relaxed);
+            g_policy_evals.store(0, std::memory_order_relaxed);
+            g_jit_nodes.store(0, std::memory_order_relaxed);
+        }
+
+        NoGradGuard::NoGradGuard() :
+            m_prev(t_grad_enabled)
+        {
+            t_grad_enabled = false;
+        }
+
+        NoGradGuard::~NoGradGuard()
+        {
+            t_grad_enabled = m_prev;
+        }
+
+        EnableGradGuard::EnableGradGuard() :
+            m_prev(t_grad_enabled)
+        {
+            t_grad_enabled = true;
+        }
+
+        EnableGradGuard::~EnableGradGuard()
+        {
+            t_grad_enabled = m_prev;
+        }
+
+        // The grad closures of exp, sigmoid, tanh, reciprocal and division reuse
+        // the forward output. When a graph is being recorded the output is
+        // evaluated once here; the closure's copy of a lazy array would
+        // otherwise re-run the whole JIT tree during backward. A retained
+        // gradient graph must be differentiable, so in that mode the closures
+        // rebuild the output from their input instead of using the constant.
+        // The eager evaluation splits fused forward chains, so EvalPolicy can
+        // turn it off (see bench_activations.cpp for the trade-off).
+        // Returns whether the output was evaluated, so that it starts a new JIT tree.
+        static bool saveForBackward(af::array& result, bool recorded)
+        {
+            if (recorded && t_grad_enabled && g_eval_saved_outputs.load(std::memory_order_relaxed)) {
+                evalArray(result, 1);
+                return true;
+            }
+            return false;
+        }
+
+        // Sorts idx and sums the entries of vals (along dim) that share an index,
+        // so that the result can be added through indexed assignment.
+        static void uniqueIndices(af::array& idx, af::array& vals, int dim)
+        {
+            af::array sorted;
+            af::array order;
+            af::sort(sorted, order, af::flat(idx).as(s32));
+            af::array keys;
+            af::sumByKey(keys, vals, sorted, af::lookup(vals, order, dim), dim);
+            idx = keys;
+        }
+
+        // Masks kept for backward are packed eight to a byte. Packing is only
+        // worth its cost when the closure will actually run, and the packed
+        // array is evaluated so that it does not keep the mask's inputs alive.
+        static af::array packMask(const af::array& mask)
+        {
+            dim_t n = mask.elements();
+            dim_t bytes = (n + 7) / 8;
+            af::array bits = af::flat(mask).as(u8);
+            if (bytes * 8 != n) {
+                bits = af::join(0, bits, af::constant(0, bytes * 8 - n, u8));
+            }
+            bits = af::moddims(bits, 8, bytes) << af::range(af::dim4(8, bytes), 0, u8);
+            return af::sum(bits, 0).as(u8);
+        }
+
+        static af::array unpackMask(const af::array& packed, const af::dim4& dims)
+        {
+            dim_t bytes = packed.elements();
+            af::array shifts = af::range(af::dim4(8, bytes), 0, u8);
+            af::array bits = (af::tile(af::moddims(packed, 1, bytes), 8) >> shifts) & 1;
+            return af::moddims(af::flat(bits)(af::seq(0, (double)dims.elements() - 1)), dims) != 0;
+        }
+
+        static af::array saveMask(const af::array& mask, bool recorded)
+        {
+            if (!recorded || !t_grad_enabled) return af::array();
+            af::array packed = packMask(mask);
+            evalArray(packed, 1);
+            return packed;
+        }
+
+        // Forward-mode differentiation: an op computes the tangent of its output
+        // when any of its inputs carries one. Inputs without a tangent
+        // contribute a lazy zero, except to products (see productTangent).
+        static bool hasTangent(const Variable& lhs, const Variable& rhs)
+        {
+            return lhs.isTangentAvailable() || rhs.isTangentAvailable();
+        }
+
+        static af::array tangentOf(const Variable& var)
+        {
+            if (var.isTangentAvailable()) return var.tangent();
+            return af::constant(0, var.dims(), var.type());
+        }
+
+        // Tangent of a product that is linear in each operand,
+        // d(a b) = da b + a db, keeping only the terms whose operand carries a
+        // tangent so that no GEMM runs on zeros. Requires hasTangent(lhs, rhs).
+        template<typename Product>
+        static af::array productTangent(const Variable& lhs, const Variable& rhs, Product product)
+        {
+            if (!rhs.isTangentAvailable()) return product(lhs.tangent(), rhs.array());
+            if (!lhs.isTangentAvailable()) return product(lhs.array(), rhs.tangent());
+            return product(lhs.tangent(), rhs.array()) + product(lhs.array(), rhs.tangent());
         }
 
         Variable::DAG_t Variable::build(const Variable& var)
@@ -165,78 +682,154 @@ namespace af {
             return dag;
         }
 
+        Variable::DAG_t Variable::build(const std::vector<Variable>& roots)
+        {
+            // Sharing the cache keeps the combined order topological, even when
+            // one root is part of another root's graph.
+            Cache_t cache;
+            Variable::DAG_t dag;
+            for (const auto& root : roots) {
+                Variable::buildSubGraph(cache, dag, root);
+            }
+            return dag;
+        }
+
 
         void Variable::buildSubGraph(Cache_t& cache, Variable::DAG_t& dag, const Variable& var)
         {
-            std::ptrdiff_t id = var.id();
-            if (cache.find(id) != cache.end()) {
+            // Iterative post-order walk: a recursive one overflows the stack on deep graphs.
+            if (!cache.emplace(var.id(), true).second) {
                 return;
             }
-            for (const auto& input : var.getInputs()) {
-                Variable::buildSubGraph(cache, dag, input);
+            std::vector<std::pair<Variable, size_t>> stack;
+            stack.emplace_back(var, 0);
+            while (!stack.empty()) {
+                auto& top = stack.back();
+                auto& inputs = top.first.getInputs();
+                if (top.second < inputs.size()) {
+                    const Variable& input = inputs[top.second++];
+                    if (cache.emplace(input.id(), true).second) {
+                        stack.emplace_back(input, 0);
+                    }
+                }
+                else {
+                    dag.push_back(top.first);
+                    stack.pop_back();
+                }
             }
-            cache[id] = true;
-            dag.push_back(var);
         }
+
         Variable negate(const Variable& input)
         {
             auto result = 0.0 - input.array();
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(negate(grad_output));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(-input.tangent());
+            }
+            return output;
         }
 
         Variable reciprocal(const Variable& input)
         {
-            auto result = 1.0 / input.array();
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                auto res = reciprocal(inputs[0]);
-                inputs[0].addGrad(negate(grad_output) * res * res);
+            af::array result = 1.0 / input.array();
+            bool saved = saveForBackward(result, input.isCalcGrad());
+            auto grad_func = [result](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    auto res = reciprocal(inputs[0]);
+                    inputs[0].addGrad(negate(grad_output) * res * res);
+                    return;
+                }
+                inputs[0].addGrad(grad_output * Variable(-result * result, false));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, saved);
+            if (input.isTangentAvailable()) {
+                output.setTangent(-result * result * input.tangent());
+            }
+            return output;
         }
 
         Variable operator +(const Variable& lhs, const Variable& rhs)
         {
             auto result = lhs.array() + rhs.array();
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                inputs[0].addGrad(grad_output);
-                inputs[1].addGrad(grad_output);
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(grad_output);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(grad_output);
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(tangentOf(lhs) + tangentOf(rhs));
+            }
+            return output;
         }
 
         Variable operator -(const Variable& lhs, const Variable& rhs)
         {
             auto result = lhs.array() - rhs.array();
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                inputs[0].addGrad(grad_output);
-                inputs[1].addGrad(negate(grad_output));
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(grad_output);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(negate(grad_output));
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(tangentOf(lhs) - tangentOf(rhs));
+            }
+            return output;
         }
 
         Variable operator *(const Variable& lhs, const Variable& rhs)
         {
             auto result = lhs.array() * rhs.array();
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                inputs[0].addGrad(grad_output * inputs[1]);
-                inputs[1].addGrad(grad_output * inputs[0]);
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(grad_output * inputs[1]);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(grad_output * inputs[0]);
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(productTangent(lhs, rhs,
+                    [](const af::array& a, const af::array& b) { return a * b; }));
+            }
+            return output;
         }
 
         Variable operator /(const Variable& lhs, const Variable& rhs)
         {
-            auto result = lhs.array() / rhs.array();
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                auto inputs_1_rec = reciprocal(inputs[1]);
-                auto grad_input_0 = grad_output * inputs_1_rec;
-                inputs[0].addGrad(grad_input_0);
-                inputs[1].addGrad(grad_input_0 * negate(inputs[0]) * inputs_1_rec);
+            af::array result = lhs.array() / rhs.array();
+            bool saved = saveForBackward(result, rhs.isCalcGrad());
+            auto grad_func = [result](std::vector<Variable>& inputs, const Variable& grad_output) {
+                // d(lhs / rhs) / d(rhs) = -(lhs / rhs) / rhs
+                auto grad_input_0 = grad_output / inputs[1];
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(grad_input_0);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    if (t_grad_enabled) {
+                        inputs[1].addGrad(grad_input_0 * negate(inputs[0]) / inputs[1]);
+                    }
+                    else {
+                        inputs[1].addGrad(grad_input_0 * Variable(-result, false));
+                    }
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func, saved);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent((tangentOf(lhs) - result * tangentOf(rhs)) / rhs.array());
+            }
+            return output;
         }
 
         Variable operator >(const Variable& lhs, const Variable& rhs)
@@ -265,30 +858,114 @@ namespace af {
 
 
 
+        // Scalar operands are kept as plain values in the forward result and in the
+        // grad closures, instead of being expanded to a full af::constant input.
+        Variable operator +(const Variable& lhs, const double& rhs_val)
+        {
+            auto result = lhs.array() + rhs_val;
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(grad_output);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent(lhs.tangent());
+            }
+            return output;
+        }
+
+        Variable operator +(const double& lhs_val, const Variable& rhs)
+        {
+            return rhs + lhs_val;
+        }
+
+        Variable operator -(const Variable& lhs, const double& rhs_val)
+        {
+            auto result = lhs.array() - rhs_val;
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(grad_output);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent(lhs.tangent());
+            }
+            return output;
+        }
+
+        Variable operator -(const double& lhs_val, const Variable& rhs)
+        {
+            auto result = lhs_val - rhs.array();
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(negate(grad_output));
+            };
+            auto output = Variable(result, { rhs }, grad_func);
+            if (rhs.isTangentAvailable()) {
+                output.setTangent(-rhs.tangent());
+            }
+            return output;
+        }
+
+        Variable operator *(const Variable& lhs, const double& rhs_val)
+        {
+            auto result = lhs.array() * rhs_val;
+            auto grad_func = [rhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(grad_output * rhs_val);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent(lhs.tangent() * rhs_val);
+            }
+            return output;
+        }
+
+        Variable operator *(const double& lhs_val, const Variable& rhs)
+        {
+            return rhs * lhs_val;
+        }
+
+        Variable operator /(const Variable& lhs, const double& rhs_val)
+        {
+            auto result = lhs.array() / rhs_val;
+            auto grad_func = [rhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(grad_output / rhs_val);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent(lhs.tangent() / rhs_val);
+            }
+            return output;
+        }
+
+        Variable operator /(const double& lhs_val, const Variable& rhs)
+        {
+            af::array result = lhs_val / rhs.array();
+            bool saved = saveForBackward(result, rhs.isCalcGrad());
+            auto grad_func = [result, lhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    inputs[0].addGrad((grad_output * -lhs_val) / (inputs[0] * inputs[0]));
+                    return;
+                }
+                inputs[0].addGrad(grad_output * Variable(-result / inputs[0].array(), false));
+            };
+            auto output = Variable(result, { rhs }, grad_func, saved);
+            if (rhs.isTangentAvailable()) {
+                output.setTangent(-result / rhs.array() * rhs.tangent());
+            }
+            return output;
+        }
+
 #define INSTANTIATE_OPERATOR(OP)                                        \
         Variable operator OP(const double &lhs_val, const Variable &rhs) \
         {                                                               \
-            auto lhs = Variable(                                        \
-                af::constant(lhs_val,                                   \
-                             rhs.array().dims(),                        \
-                             rhs.array().type()),                       \
-                false);                                                 \
-            return lhs OP rhs;                                          \
+            auto result = lhs_val OP rhs.array();                       \
+            return Variable(result, false);                             \
         }                                                               \
         Variable operator OP(const Variable &lhs, const double &rhs_val) \
         {                                                               \
-            auto rhs = Variable(                                        \
-                af::constant(rhs_val,                                   \
-                             lhs.array().dims(), lhs.array().type()),   \
-                false);                                                 \
-            return lhs OP rhs;                                          \
+            auto result = lhs.array() OP rhs_val;                       \
+            return Variable(result, false);                             \
         }                                                               \
 
-        INSTANTIATE_OPERATOR(+)
-            INSTANTIATE_OPERATOR(-)
-            INSTANTIATE_OPERATOR(*)
-            INSTANTIATE_OPERATOR(/ )
-            INSTANTIATE_OPERATOR(> )
+        INSTANTIATE_OPERATOR(> )
             INSTANTIATE_OPERATOR(< )
             INSTANTIATE_OPERATOR(>= )
             INSTANTIATE_OPERATOR(<= )
@@ -303,62 +980,159 @@ namespace af {
 
         Variable max(const Variable& lhs, const Variable& rhs)
         {
-            auto mask = lhs > rhs;
+            af::array mask = lhs.array() > rhs.array();
             auto result = max(lhs.array(), rhs.array());
+            af::array packed = saveMask(mask, lhs.isCalcGrad() || rhs.isCalcGrad());
 
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                inputs[0].addGrad(inputs[2] * grad_output);
-                inputs[1].addGrad(!inputs[2] * grad_output);
+            auto grad_func = [packed](std::vector<Variable>& inputs, const Variable& grad_output) {
+                af::array mask = unpackMask(packed, grad_output.dims());
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(Variable(mask, false) * grad_output);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(Variable(!mask, false) * grad_output);
+                }
             };
-            return Variable(result, { lhs, rhs, mask }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(af::select(mask, tangentOf(lhs), tangentOf(rhs)));
+            }
+            return output;
         }
 
         Variable min(const Variable& lhs, const Variable& rhs)
         {
-            auto mask = lhs < rhs;
+            af::array mask = lhs.array() < rhs.array();
             auto result = min(lhs.array(), rhs.array());
+            af::array packed = saveMask(mask, lhs.isCalcGrad() || rhs.isCalcGrad());
 
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                inputs[0].addGrad(inputs[2] * grad_output);
-                inputs[1].addGrad(!inputs[2] * grad_output);
+            auto grad_func = [packed](std::vector<Variable>& inputs, const Variable& grad_output) {
+                af::array mask = unpackMask(packed, grad_output.dims());
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(Variable(mask, false) * grad_output);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(Variable(!mask, false) * grad_output);
+                }
             };
-            return Variable(result, { lhs, rhs, mask }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(af::select(mask, tangentOf(lhs), tangentOf(rhs)));
+            }
+            return output;
         }
 
-#define INSTANTIATE_FUNCTION(FN)                                        \
-        Variable FN(const double &lhs_val, const Variable &rhs)         \
-        {                                                               \
-            auto lhs = Variable(                                        \
-                af::constant(lhs_val,                                   \
-                             rhs.array().dims(),                        \
-                             rhs.array().type()),                       \
-                false);                                                 \
-            return FN(lhs,rhs);                                         \
-        }                                                               \
-        Variable FN(const Variable &lhs, const double &rhs_val)         \
-        {                                                               \
-            auto rhs = Variable(                                        \
-                af::constant(rhs_val,                                   \
-                             lhs.array().dims(), lhs.array().type()),   \
-                false);                                                 \
-            return FN(lhs, rhs);                                        \
+        // The masks of the scalar variants are recomputed from the input in
+        // backward rather than stored as an extra graph input.
+        Variable max(const Variable& lhs, const double& rhs_val)
+        {
+            auto result = max(lhs.array(), rhs_val);
+            auto grad_func = [rhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                auto mask = Variable(inputs[0].array() > rhs_val, false);
+                inputs[0].addGrad(mask * grad_output);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent((lhs.array() > rhs_val) * lhs.tangent());
+            }
+            return output;
         }
 
+        Variable max(const double& lhs_val, const Variable& rhs)
+        {
+            auto result = max(lhs_val, rhs.array());
+            auto grad_func = [lhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                auto mask = Variable(inputs[0].array() >= lhs_val, false);
+                inputs[0].addGrad(mask * grad_output);
+            };
+            auto output = Variable(result, { rhs }, grad_func);
+            if (rhs.isTangentAvailable()) {
+                output.setTangent((rhs.array() >= lhs_val) * rhs.tangent());
+            }
+            return output;
+        }
 
-        INSTANTIATE_FUNCTION(max);
-        INSTANTIATE_FUNCTION(min);
+        Variable min(const Variable& lhs, const double& rhs_val)
+        {
+            auto result = min(lhs.array(), rhs_val);
+            auto grad_func = [rhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                auto mask = Variable(inputs[0].array() < rhs_val, false);
+                inputs[0].addGrad(mask * grad_output);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent((lhs.array() < rhs_val) * lhs.tangent());
+            }
+            return output;
+        }
 
-#undef INSTANTIATE_FUNCTION
+        Variable min(const double& lhs_val, const Variable& rhs)
+        {
+            auto result = min(lhs_val, rhs.array());
+            auto grad_func = [lhs_val](std::vector<Variable>& inputs, const Variable& grad_output) {
+                auto mask = Variable(inputs[0].array() <= lhs_val, false);
+                inputs[0].addGrad(mask * grad_output);
+            };
+            auto output = Variable(result, { rhs }, grad_func);
+            if (rhs.isTangentAvailable()) {
+                output.setTangent((rhs.array() <= lhs_val) * rhs.tangent());
+            }
+            return output;
+        }
+
+        Variable select(const Variable& cond, const Variable& lhs, const Variable& rhs)
+        {
+            auto result = af::select(cond.array(), lhs.array(), rhs.array());
+            af::array packed = saveMask(cond.array(), lhs.isCalcGrad() || rhs.isCalcGrad());
+            auto grad_func = [packed](std::vector<Variable>& inputs, const Variable& grad_output) {
+                af::array mask = unpackMask(packed, grad_output.dims());
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(Variable(mask, false) * grad_output);
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(Variable(!mask, false) * grad_output);
+                }
+            };
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(af::select(cond.array(), tangentOf(lhs), tangentOf(rhs)));
+            }
+            return output;
+        }
+
+        Variable select(const Variable& cond, const Variable& lhs, const double& rhs_val)
+        {
+            auto result = af::select(cond.array(), lhs.array(), rhs_val);
+            af::array packed = saveMask(cond.array(), lhs.isCalcGrad());
+            auto grad_func = [packed](std::vector<Variable>& inputs, const Variable& grad_output) {
+                auto mask = Variable(unpackMask(packed, grad_output.dims()), false);
+                inputs[0].addGrad(mask * grad_output);
+            };
+            auto output = Variable(result, { lhs }, grad_func);
+            if (lhs.isTangentAvailable()) {
+                output.setTangent(af::select(cond.array(), lhs.tangent(), 0.0));
+            }
+            return output;
+        }
 
 
 
         Variable exp(const Variable& input)
         {
-            auto result = exp(input.array());
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                inputs[0].addGrad(grad_output * exp(inputs[0]));
+            af::array result = exp(input.array());
+            bool saved = saveForBackward(result, input.isCalcGrad());
+            auto grad_func = [result](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    inputs[0].addGrad(grad_output * exp(inputs[0]));
+                    return;
+                }
+                inputs[0].addGrad(grad_output * Variable(result, false));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, saved);
+            if (input.isTangentAvailable()) {
+                output.setTangent(result * input.tangent());
+            }
+            return output;
         }
         Variable sin(const Variable& input)
         {
@@ -366,7 +1140,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(grad_output * cos(inputs[0]));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(cos(input.array()) * input.tangent());
+            }
+            return output;
         }
         Variable cos(const Variable& input)
         {
@@ -374,7 +1152,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(grad_output * negate(sin(inputs[0])));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(-sin(input.array()) * input.tangent());
+            }
+            return output;
         }
 
 
@@ -385,7 +1167,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(grad_output / inputs[0]);
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(input.tangent() / input.array());
+            }
+            return output;
         }
 
 
@@ -393,22 +1179,40 @@ namespace af {
 
         Variable tanh(const Variable& input)
         {
-            auto result = tanh(input.array());
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                auto tmp = tanh(inputs[0]);
-                inputs[0].addGrad(grad_output * (1.0 - tmp * tmp));
+            af::array result = tanh(input.array());
+            bool saved = saveForBackward(result, input.isCalcGrad());
+            auto grad_func = [result](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    auto tmp = tanh(inputs[0]);
+                    inputs[0].addGrad(grad_output * (1.0 - tmp * tmp));
+                    return;
+                }
+                inputs[0].addGrad(grad_output * Variable(1.0 - result * result, false));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, saved);
+            if (input.isTangentAvailable()) {
+                output.setTangent((1.0 - result * result) * input.tangent());
+            }
+            return output;
         }
 
         Variable sigmoid(const Variable& input)
         {
-            auto result = sigmoid(input.array());
-            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
-                auto tmp = sigmoid(inputs[0]);
-                inputs[0].addGrad(grad_output * tmp * (1 - tmp));
+            af::array result = sigmoid(input.array());
+            bool saved = saveForBackward(result, input.isCalcGrad());
+            auto grad_func = [result](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    auto tmp = sigmoid(inputs[0]);
+                    inputs[0].addGrad(grad_output * tmp * (1 - tmp));
+                    return;
+                }
+                inputs[0].addGrad(grad_output * Variable(result * (1 - result), false));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, saved);
+            if (input.isTangentAvailable()) {
+                output.setTangent(result * (1 - result) * input.tangent());
+            }
+            return output;
         }
 
         Variable transpose(const Variable& input)
@@ -417,7 +1221,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(transpose(grad_output));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, true);
+            if (input.isTangentAvailable()) {
+                output.setTangent(transpose(input.tangent()));
+            }
+            return output;
         }
         Variable tileAs(const Variable& input, const Variable& reference)
         {
@@ -431,7 +1239,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(sumAs(grad_output, inputs[0]));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(tile(input.tangent(), dims));
+            }
+            return output;
         }
         Variable sumAs(const Variable& input, const Variable& reference)
         {
@@ -444,12 +1256,223 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(tileAs(grad_output, inputs[0]));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                af::array tangent = input.tangent();
+                for (int i = 0; i < 4; i++) {
+                    if (idims[i] != rdims[i]) tangent = sum(tangent, i);
+                }
+                output.setTangent(tangent);
+            }
+            return output;
         }
 
 
 
 
+        // Elementwise ops where each dimension of an operand either matches the
+        // other operand or is 1. af::batchFunc broadcasts the smaller operand
+        // without the full-size copy that tileAs materialises, and backward
+        // needs only one reduction per broadcast operand.
+        static af::array batchAdd(const af::array& lhs, const af::array& rhs)
+        {
+            return lhs + rhs;
+        }
+
+        static af::array batchSub(const af::array& lhs, const af::array& rhs)
+        {
+            return lhs - rhs;
+        }
+
+        static af::array batchMul(const af::array& lhs, const af::array& rhs)
+        {
+            return lhs * rhs;
+        }
+
+        static Variable reduceAs(const Variable& grad, const Variable& reference)
+        {
+            if (grad.dims() == reference.dims()) return grad;
+            return sumAs(grad, reference);
+        }
+
+        Variable broadcastAdd(const Variable& lhs, const Variable& rhs)
+        {
+            auto result = af::batchFunc(lhs.array(), rhs.array(), batchAdd);
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(reduceAs(grad_output, inputs[0]));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(reduceAs(grad_output, inputs[1]));
+                }
+            };
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(af::batchFunc(tangentOf(lhs), tangentOf(rhs), batchAdd));
+            }
+            return output;
+        }
+
+        Variable broadcastSub(const Variable& lhs, const Variable& rhs)
+        {
+            auto result = af::batchFunc(lhs.array(), rhs.array(), batchSub);
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(reduceAs(grad_output, inputs[0]));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(negate(reduceAs(grad_output, inputs[1])));
+                }
+            };
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(af::batchFunc(tangentOf(lhs), tangentOf(rhs), batchSub));
+            }
+            return output;
+        }
+
+        Variable broadcastMul(const Variable& lhs, const Variable& rhs)
+        {
+            auto result = af::batchFunc(lhs.array(), rhs.array(), batchMul);
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(reduceAs(broadcastMul(grad_output, inputs[1]), inputs[0]));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(reduceAs(broadcastMul(grad_output, inputs[0]), inputs[1]));
+                }
+            };
+            auto output = Variable(result, { lhs, rhs }, grad_func);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(productTangent(lhs, rhs,
+                    [](const af::array& a, const af::array& b) { return af::batchFunc(a, b, batchMul); }));
+            }
+            return output;
+        }
+
+        Variable relu(const Variable& input)
+        {
+            auto result = af::max(input.array(), 0.0);
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(grad_output * (inputs[0] > 0.0));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent((input.array() > 0) * input.tangent());
+            }
+            return output;
+        }
+
+        Variable leakyRelu(const Variable& input, double slope)
+        {
+            af::array mask = input.array() >= 0;
+            auto result = af::select(mask, input.array(), slope * input.array());
+            auto grad_func = [slope](std::vector<Variable>& inputs, const Variable& grad_output) {
+                // A b8 mask times a double is f32; keep f16 gradients f16
+                af::array mask = inputs[0].array() >= 0;
+                af::array factor = (1 - (1 - slope) * !mask).as(grad_output.type());
+                inputs[0].addGrad(grad_output * Variable(factor, false));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::select(mask, input.tangent(), slope * input.tangent()));
+            }
+            return output;
+        }
+
+        Variable prelu(const Variable& input, const Variable& weight)
+        {
+            // weight is broadcast along every dimension where it is 1
+            af::array mask = input.array() >= 0;
+            auto result = af::select(mask, input.array(), af::batchFunc(input.array(), weight.array(), batchMul));
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    auto mask = inputs[0] >= 0.0;
+                    if (inputs[0].isCalcGrad()) {
+                        inputs[0].addGrad(select(mask, grad_output, broadcastMul(grad_output, inputs[1])));
+                    }
+                    if (inputs[1].isCalcGrad()) {
+                        inputs[1].addGrad(reduceAs(select(!mask, grad_output * inputs[0], 0.0), inputs[1]));
+                    }
+                    return;
+                }
+                af::array mask = inputs[0].array() >= 0;
+                const af::array& grad = grad_output.array();
+                if (inputs[0].isCalcGrad()) {
+                    auto grad_input = af::select(mask, grad, af::batchFunc(grad, inputs[1].array(), batchMul));
+                    inputs[0].addGrad(Variable(grad_input, false));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    auto grad_weight = af::select(mask, 0.0, grad * inputs[0].array());
+                    inputs[1].addGrad(reduceAs(Variable(grad_weight, false), inputs[1]));
+                }
+            };
+            auto output = Variable(result, { input, weight }, grad_func);
+            if (hasTangent(input, weight)) {
+                output.setTangent(af::select(mask, tangentOf(input), productTangent(input, weight,
+                    [](const af::array& a, const af::array& b) { return af::batchFunc(a, b, batchMul); })));
+            }
+            return output;
+        }
+
+        Variable elu(const Variable& input, double alpha)
+        {
+            af::array mask = input.array() >= 0;
+            af::array result = af::select(mask, input.array(), alpha * (af::exp(input.array()) - 1));
+            bool saved = saveForBackward(result, input.isCalcGrad());
+            auto grad_func = [result, alpha](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    inputs[0].addGrad(select(inputs[0] >= 0.0, grad_output, grad_output * (alpha * exp(inputs[0]))));
+                    return;
+                }
+                // Below zero d(elu)/dx = alpha * exp(x) = output + alpha
+                af::array mask = inputs[0].array() >= 0;
+                inputs[0].addGrad(Variable(af::select(mask, grad_output.array(), grad_output.array() * (result + alpha)), false));
+            };
+            auto output = Variable(result, { input }, grad_func, saved);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::select(mask, input.tangent(), (result + alpha) * input.tangent()));
+            }
+            return output;
+        }
+
+        Variable thresholdRelu(const Variable& input, double threshold)
+        {
+            auto result = af::select(input.array() >= threshold, input.array(), 0.0);
+            auto grad_func = [threshold](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(grad_output * (inputs[0] >= threshold));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent((input.array() >= threshold) * input.tangent());
+            }
+            return output;
+        }
+
+        Variable dropout(const Variable& input, double ratio, af::randomEngine& engine)
+        {
+            if (ratio < 0 || ratio >= 1) {
+                throw af::exception("dropout: Ratio must be in [0, 1).");
+            }
+            if (ratio == 0) return input;
+
+            // 16 random bits per element are plenty to threshold against
+            double scale = 1.0 / (1.0 - ratio);
+            af::array keep = af::randu(input.dims(), u16, engine) >= (unsigned)(ratio * 65536);
+            auto result = af::select(keep, input.array() * scale, 0.0);
+            af::array packed = saveMask(keep, input.isCalcGrad());
+            auto grad_func = [packed, scale](std::vector<Variable>& inputs, const Variable& grad_output) {
+                af::array keep = unpackMask(packed, grad_output.dims());
+                // keep * scale is f32; keep f16 gradients f16
+                inputs[0].addGrad(grad_output * Variable((keep * scale).as(grad_output.type()), false));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::select(keep, input.tangent() * scale, 0.0));
+            }
+            return output;
+        }
+
         Variable tile(const Variable& input, const std::vector<int>& repeats)
         {
             af::dim4 dims;
@@ -460,7 +1483,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(sumAs(grad_output, inputs[0]));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(tile(input.tangent(), dims));
+            }
+            return output;
         }
 
         Variable sum(const Variable& input, const std::vector<int>& axes)
@@ -472,7 +1499,15 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(tileAs(grad_output, inputs[0]));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, !axes.empty());
+            if (input.isTangentAvailable()) {
+                af::array tangent = input.tangent();
+                for (size_t i = 0; i < axes.size(); i++) {
+                    tangent = sum(tangent, axes[i]);
+                }
+                output.setTangent(tangent);
+            }
+            return output;
         }
 
         Variable mean(const Variable& input, const std::vector<int>& axes)
@@ -490,7 +1525,15 @@ namespace af {
                 }
                 inputs[0].addGrad(count * tileAs(grad_output, inputs[0]));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func, !axes.empty());
+            if (input.isTangentAvailable()) {
+                af::array tangent = input.tangent();
+                for (size_t i = 0; i < axes.size(); i++) {
+                    tangent = mean(tangent, axes[i]);
+                }
+                output.setTangent(tangent);
+            }
+            return output;
         }
         Variable matmulTN(const Variable& lhs, const Variable& rhs)
         {
@@ -505,12 +1548,21 @@ namespace af {
                 // matmulNT(inputs[1], grad_output)
                 // -- matmulNT([N, K], [M, K])
                 // -- matmul([N, K], [K, M]) -- [N, M]
-                inputs[0].addGrad(matmulNT(inputs[1], grad_output));
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(matmulNT(inputs[1], grad_output));
+                }
                 // matmul(inputs[0], grad_output)
                 // -- matmulNT([N, M], [M, K]) -- [N, K]
-                inputs[1].addGrad(matmul(inputs[0], grad_output));
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(matmul(inputs[0], grad_output));
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func, true);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(productTangent(lhs, rhs,
+                    [](const af::array& a, const af::array& b) { return matmulTN(a, b); }));
+            }
+            return output;
         }
 
         Variable matmul(const Variable& lhs, const Variable& rhs)
@@ -525,13 +1577,22 @@ namespace af {
                 // matmulNT(grad_output, inputs[1])
                 // -- matmulNT([M, K], [N, K])
                 // -- matmul([M, K], [K, N]) -- [M, K]
-                inputs[0].addGrad(matmulNT(grad_output, inputs[1]));
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(matmulNT(grad_output, inputs[1]));
+                }
                 // matmulTN(inputs[0], grad_output)
                 // -- matmulTN([M, N], [M, K])
                 // -- matmul([N, M], [M, K]) -- [N, K]
-                inputs[1].addGrad(matmulTN(inputs[0], grad_output));
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(matmulTN(inputs[0], grad_output));
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func, true);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(productTangent(lhs, rhs,
+                    [](const af::array& a, const af::array& b) { return matmul(a, b); }));
+            }
+            return output;
         }
 
 
@@ -547,13 +1608,163 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 // matmul(grad_output, inputs[1])
                 // -- matmul([M, K], [K, N]) -- [M, N]
-                inputs[0].addGrad(matmul(grad_output, inputs[1]));
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(matmul(grad_output, inputs[1]));
+                }
                 // matmulTN(grad_output, inputs[0])
                 // -- matmulTN([M, K], [M, N])
                 // -- matmul([K, M], [M, N]) -- [K, N]
-                inputs[1].addGrad(matmulTN(grad_output, inputs[0]));
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(matmulTN(grad_output, inputs[0]));
+                }
             };
-            return Variable(result, { lhs, rhs }, grad_func);
+            auto output = Variable(result, { lhs, rhs }, grad_func, true);
+            if (hasTangent(lhs, rhs)) {
+                output.setTangent(productTangent(lhs, rhs,
+                    [](const af::array& a, const af::array& b) { return matmulNT(a, b); }));
+            }
+            return output;
+        }
+
+        // Derivative of an activation, expressed through its output
+        static af::array activationGrad(const af::array& output, Activation act)
+        {
+            switch (act) {
+            case Activation::ReLU:
+                return (output > 0).as(output.type());
+            case Activation::Sigmoid:
+                return output * (1 - output);
+            case Activation::Tanh:
+                return 1 - output * output;
+            default:
+                return af::constant(1, output.dims(), output.type());
+            }
+        }
+
+        static af::array activate(const af::array& input, Activation act)
+        {
+            switch (act) {
+            case Activation::ReLU:
+                return af::max(input, 0.0);
+            case Activation::Sigmoid:
+                return af::sigmoid(input);
+            case Activation::Tanh:
+                return af::tanh(input);
+            default:
+                return input;
+            }
+        }
+
+        // Differentiable counterpart of grad_output * activationGrad, rebuilt
+        // from the pre-activation for a retained gradient graph
+        static Variable activationBackward(const Variable& grad_output, const Variable& preact, Activation act)
+        {
+            switch (act) {
+            case Activation::ReLU:
+                return grad_output * (preact > 0.0);
+            case Activation::Sigmoid: {
+                auto out = sigmoid(preact);
+                return grad_output * out * (1.0 - out);
+            }
+            case Activation::Tanh: {
+                auto out = tanh(preact);
+                return grad_output * (1.0 - out * out);
+            }
+            default:
+                return grad_output;
+            }
+        }
+
+        Variable linear(const Variable& input, const Variable& weight, const Variable& bias, Activation act)
+        {
+            // input:Input[0] -- [N, B]
+            // weight:Input[1] -- [M, N]
+            // bias:Input[2] -- [M, 1], optional
+            // result:grad_output -- [M, B]
+            bool has_bias = !bias.array().isempty();
+            af::array preact = matmul(weight.array(), input.array());
+            if (has_bias) {
+                preact = af::batchFunc(preact, bias.array(), batchAdd);
+            }
+            // Bias and activation run as one epilogue kernel
+            af::array result = activate(preact, act);
+            evalArray(result, 1);
+
+            auto grad_func = [result, act](std::vector<Variable>& inputs, const Variable& grad_output) {
+                Variable grad_preact;
+                if (t_grad_enabled) {
+                    auto z = matmul(inputs[1], inputs[0]);
+                    if (inputs.size() > 2) {
+                        z = broadcastAdd(z, inputs[2]);
+                    }
+                    grad_preact = activationBackward(grad_output, z, act);
+                }
+                else if (act == Activation::None) {
+                    grad_preact = grad_output;
+                }
+                else {
+                    grad_preact = grad_output * Variable(activationGrad(result, act), false);
+                }
+                if (inputs[0].isCalcGrad()) {
+                    inputs[0].addGrad(matmulTN(inputs[1], grad_preact));
+                }
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(matmulNT(grad_preact, inputs[0]));
+                }
+                if (inputs.size() > 2 && inputs[2].isCalcGrad()) {
+                    inputs[2].addGrad(sum(grad_preact, { 1 }));
+                }
+            };
+            std::vector<Variable> inputs = { input, weight };
+            if (has_bias) {
+                inputs.push_back(bias);
+            }
+            bool tangent = input.isTangentAvailable() || weight.isTangentAvailable() ||
+                (has_bias && bias.isTangentAvailable());
+            auto output = Variable(result, std::move(inputs), grad_func, true);
+            if (tangent) {
+                af::array preact_tangent;
+                if (hasTangent(weight, input)) {
+                    preact_tangent = productTangent(weight, input,
+                        [](const af::array& a, const af::array& b) { return matmul(a, b); });
+                }
+                if (has_bias && bias.isTangentAvailable()) {
+                    preact_tangent = preact_tangent.isempty()
+                        ? af::tile(bias.tangent(), 1, (unsigned)input.dims()[1])
+                        : af::batchFunc(preact_tangent, bias.tangent(), batchAdd);
+                }
+                output.setTangent(activationGrad(result, act) * preact_tangent);
+            }
+            return output;
+        }
+
+        Variable linear(const Variable& input, const Variable& weight, Activation act)
+        {
+            return linear(input, weight, Variable(af::array(), false), act);
+        }
+
+        Variable sparseMatmul(const Variable& sparse, const Variable& dense, bool transpose_sparse)
+        {
+            // sparse:Input[0] -- [M, N] (or [N, M] when transposed)
+            // dense:Input[1] -- [N, K]
+            // result:grad_output -- [M, K]
+            if (!sparse.array().issparse()) {
+                throw af::exception("sparseMatmul: First operand must be a sparse array.");
+            }
+            af_mat_prop opt = transpose_sparse ? AF_MAT_TRANS : AF_MAT_NONE;
+            auto result = matmul(sparse.array(), dense.array(), opt, AF_MAT_NONE);
+            auto grad_func = [transpose_sparse](std::vector<Variable>& inputs, const Variable& grad_output) {
+                // The product with the other orientation of the sparse matrix
+                // -- [N, M] x [M, K] -- [N, K], at a cost proportional to its non-zeros
+                if (inputs[1].isCalcGrad()) {
+                    inputs[1].addGrad(sparseMatmul(inputs[0], grad_output, !transpose_sparse));
+                }
+            };
+            auto output = Variable(result, { sparse, dense }, grad_func, true);
+            if (dense.isTangentAvailable()) {
+                output.setTangent(matmul(sparse.array(), dense.tangent(), opt, AF_MAT_NONE));
+            }
+            return output;
         }
 
         Variable abs(const Variable& input)
@@ -565,7 +1776,11 @@ namespace af {
                 auto sign = Variable(1 - 2 * af::sign(inputs[0].array()), false);
                 inputs[0].addGrad(sign * grad_output);
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent((1 - 2 * af::sign(input.array())) * input.tangent());
+            }
+            return output;
         }
 
         Variable flat(const Variable& input)
@@ -574,7 +1789,11 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(moddims(grad_output, inputs[0].dims()));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::flat(input.tangent()));
+            }
+            return output;
         }
 
         Variable moddims(const Variable& input, const af::dim4& dims)
@@ -583,7 +1802,224 @@ namespace af {
             auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
                 inputs[0].addGrad(moddims(grad_output, inputs[0].dims()));
             };
-            return Variable(result, { input }, grad_func);
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::moddims(input.tangent(), dims));
+            }
+            return output;
+        }
+
+        Variable reorder(const Variable& input, int d0, int d1, int d2, int d3)
+        {
+            auto result = af::reorder(input.array(), d0, d1, d2, d3);
+            auto grad_func = [d0, d1, d2, d3](std::vector<Variable>& inputs, const Variable& grad_output) {
+                // Inverse permutation
+                int perm[4] = { d0, d1, d2, d3 };
+                int inv[4];
+                for (int i = 0; i < 4; i++) {
+                    inv[perm[i]] = i;
+                }
+                inputs[0].addGrad(reorder(grad_output, inv[0], inv[1], inv[2], inv[3]));
+            };
+            auto output = Variable(result, { input }, grad_func, true);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::reorder(input.tangent(), d0, d1, d2, d3));
+            }
+            return output;
+        }
+
+        Variable reduceMax(const Variable& input, int dim)
+        {
+            af::array result;
+            af::array idx;
+            af::max(result, idx, input.array(), dim);
+            // One-hot of the argmax along dim; idx holds one entry per output
+            auto argmaxMask = [](const af::array& idx, const af::dim4& dims, int dim) {
+                af::dim4 tiles(1, 1, 1, 1);
+                tiles[dim] = dims[dim];
+                return af::range(dims, dim, u32) == af::tile(idx, tiles);
+            };
+            auto grad_func = [idx, dim, argmaxMask](std::vector<Variable>& inputs, const Variable& grad_output) {
+                auto mask = Variable(argmaxMask(idx, inputs[0].dims(), dim), false);
+                inputs[0].addGrad(tileAs(grad_output, inputs[0]) * mask);
+            };
+            auto output = Variable(result, { input }, grad_func, true);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::sum(argmaxMask(idx, input.dims(), dim) * input.tangent(), dim));
+            }
+            return output;
+        }
+
+        Variable unwrap(const Variable& input, int wx, int wy, int sx, int sy, int px, int py)
+        {
+            auto result = af::unwrap(input.array(), wx, wy, sx, sy, px, py);
+            auto grad_func = [wx, wy, sx, sy, px, py](std::vector<Variable>& inputs, const Variable& grad_output) {
+                af::dim4 dims = inputs[0].dims();
+                inputs[0].addGrad(wrap(grad_output, (int)dims[0], (int)dims[1], wx, wy, sx, sy, px, py));
+            };
+            auto output = Variable(result, { input }, grad_func, true);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::unwrap(input.tangent(), wx, wy, sx, sy, px, py));
+            }
+            return output;
+        }
+
+        Variable wrap(const Variable& input, int ox, int oy, int wx, int wy, int sx, int sy, int px, int py)
+        {
+            auto result = af::wrap(input.array(), ox, oy, wx, wy, sx, sy, px, py);
+            auto grad_func = [wx, wy, sx, sy, px, py](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(unwrap(grad_output, wx, wy, sx, sy, px, py));
+            };
+            auto output = Variable(result, { input }, grad_func, true);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::wrap(input.tangent(), ox, oy, wx, wy, sx, sy, px, py));
+            }
+            return output;
+        }
+
+        Variable cast(const Variable& input, af::dtype type)
+        {
+            auto result = input.array().as(type);
+            auto grad_func = [](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(cast(grad_output, inputs[0].type()));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(input.tangent().as(type));
+            }
+            return output;
+        }
+
+        static af::index seqIndex(int first, int last)
+        {
+            return af::index(af::seq(first, last));
+        }
+
+        static af::array sliceArray(const af::array& arr, int dim, const af::index& idx)
+        {
+            af::index ix[4] = { af::span, af::span, af::span, af::span };
+            ix[dim] = idx;
+            return af::array(arr(ix[0], ix[1], ix[2], ix[3]));
+        }
+
+        // Adjoint of gather: a dense array of the given dims holding grad summed
+        // into the positions idx along dim. Only used when a retained gradient
+        // graph needs the scatter to be differentiable itself.
+        static Variable scatterAdd(const Variable& grad, const af::dim4& dims, const af::array& idx, int dim)
+        {
+            af::array keys = idx;
+            af::array vals = grad.array();
+            uniqueIndices(keys, vals, dim);
+            af::array result = af::constant(0, dims, grad.type());
+            af::index ix[4] = { af::span, af::span, af::span, af::span };
+            ix[dim] = keys;
+            result(ix[0], ix[1], ix[2], ix[3]) = vals;
+            auto grad_func = [idx, dim](std::vector<Variable>& inputs, const Variable& grad_output) {
+                inputs[0].addGrad(gather(grad_output, idx, dim));
+            };
+            return Variable(result, { grad }, grad_func);
+        }
+
+        Variable slice(const Variable& input, int dim, int first, int last)
+        {
+            auto result = sliceArray(input.array(), dim, seqIndex(first, last));
+            auto grad_func = [dim, first, last](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    af::array idx = af::range(af::dim4(last - first + 1), 0, s32) + first;
+                    inputs[0].addGrad(scatterAdd(grad_output, inputs[0].dims(), idx, dim));
+                    return;
+                }
+                inputs[0].addGrad(grad_output.array(), dim, seqIndex(first, last));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(sliceArray(input.tangent(), dim, seqIndex(first, last)));
+            }
+            return output;
+        }
+
+        Variable index(const Variable& input, int dim, int i)
+        {
+            return slice(input, dim, i, i);
+        }
+
+        Variable gather(const Variable& input, const af::array& idx, int dim)
+        {
+            auto result = af::lookup(input.array(), idx, dim);
+            auto grad_func = [idx, dim](std::vector<Variable>& inputs, const Variable& grad_output) {
+                if (t_grad_enabled) {
+                    inputs[0].addGrad(scatterAdd(grad_output, inputs[0].dims(), idx, dim));
+                    return;
+                }
+                af::array keys = idx;
+                af::array vals = grad_output.array();
+                uniqueIndices(keys, vals, dim);
+                inputs[0].addGrad(vals, dim, af::index(keys));
+            };
+            auto output = Variable(result, { input }, grad_func);
+            if (input.isTangentAvailable()) {
+                output.setTangent(af::lookup(input.tangent(), idx, dim));
+            }
+            return output;
+        }
+
+        // af_join_many takes at most 10 arrays at a time.
+        static af::array joinArrays(int dim, const std::vector<af::array>& arrays)
+        {
+            const size_t max_join = 10;
+            if (arrays.size() == 1) return arrays[0];
+            if (arrays.size() > max_join) {
+                std::vector<af::array> joined;
+                for (size_t i = 0; i < arrays.size(); i += max_join) {
+                    size_t end = std::min(arrays.size(), i + max_join);
+                    joined.push_back(joinArrays(dim, std::vector<af::array>(arrays.begin() + i, arrays.begin() + end)));
+                }
+                return joinArrays(dim, joined);
+            }
+            std::vector<af_array> handles;
+            for (const auto& arr : arrays) {
+                handles.push_back(arr.get());
+            }
+            af_array out = 0;
+            if (af_join_many(&out, dim, (unsigned)handles.size(), handles.data()) != AF_SUCCESS) {
+                throw af::exception("concat: Joining the inputs failed.");
+            }
+            return af::array(out);
+        }
+
+        Variable concat(const std::vector<Variable>& inputs, int dim)
+        {
+            if (inputs.empty()) {
+                throw af::exception("concat: No inputs.");
+            }
+            std::vector<af::array> arrays;
+            std::vector<int> offsets;
+            int offset = 0;
+            bool tangent = false;
+            for (const auto& input : inputs) {
+                arrays.push_back(input.array());
+                offsets.push_back(offset);
+                offset += (int)input.dims()[dim];
+                tangent |= input.isTangentAvailable();
+            }
+            auto result = joinArrays(dim, arrays);
+            auto grad_func = [offsets, dim](std::vector<Variable>& inputs, const Variable& grad_output) {
+                for (size_t i = 0; i < inputs.size(); i++) {
+                    if (inputs[i].isCalcGrad()) {
+                        int first = offsets[i];
+                        inputs[i].addGrad(slice(grad_output, dim, first, first + (int)inputs[i].dims()[dim] - 1));
+                    }
+                }
+            };
+            auto output = Variable(result, inputs, grad_func, true);
+            if (tangent) {
+                std::vector<af::array> tangents;
+                for (const auto& input : inputs) {
+                    tangents.push_back(tangentOf(input));
+                }
+                output.setTangent(joinArrays(dim, tangents));
+            }
+            return output;
         }
     }
-}
\ No newline at end of file
+}
@@ -10,6 +10,42 @@
 #undef min
 namespace af {
     namespace autograd {
+        class Tape;
+        class BackwardScheduler;
+
+        // Activations that fused ops apply to their output
+        enum class Activation { None, ReLU, Sigmoid, Tanh };
+
+        // When Variable ops evaluate their lazy ArrayFire result. An op's output
+        // is one JIT node deeper than its deepest input and carries an upper bound
+        // on the number of nodes in its expression; once either limit is reached
+        // the output is evaluated. Zero disables a limit. In backward, a gradient
+        // piece wrapped as Variable(expr, false) is counted as one node deeper
+        // than the gradient it was computed from, and a tangent as one node
+        // deeper than its op's input tangents, so both fall under the policy too.
+        // eval_saved_outputs evaluates the outputs that exp, sigmoid, tanh,
+        // reciprocal, division and elu keep for backward, so backward does not
+        // re-run their JIT trees; turning it off keeps forward chains fused.
+        struct EvalPolicy
+        {
+            EvalPolicy(unsigned max_depth = 0, size_t max_nodes = 0, bool eval_saved_outputs = true);
+
+            unsigned max_depth;
+            size_t max_nodes;
+            bool eval_saved_outputs;
+        };
+
+        // Evaluations forced by autograd: the eval policy, gradient accumulation
+        // and outputs saved for backward. ArrayFire does not report its kernel
+        // compilations, so jit_nodes (the ops folded into those evaluations) is
+        // the closest proxy for the amount of code generated.
+        struct EvalStats
+        {
+            size_t evals;
+            size_t policy_evals;
+            size_t jit_nodes;
+        };
+
         class Variable
         {
         public:
@@ -22,15 +58,23 @@ namespace af {
                 Shared();
                 Shared(const af::array& data, bool calc_grad);
                 Shared(const af::array& data,
-                    const std::vector<Variable>& inputs,
-                    GradFunc_t grad_func,
+                    std::vector<Variable>&& inputs,
+                    GradFunc_t&& grad_func,
                     bool calc_grad);
 
                 bool m_calc_grad;
                 af::array m_data;
                 std::vector<Variable> m_inputs;
+                // Holds at most one Variable: the gradient accumulated so far.
                 std::vector<Variable> m_grads;
+                bool m_grad_owned;
                 GradFunc_t m_grad_func;
+                af::array m_tangent;
+                unsigned long m_tape_stamp;
+                unsigned m_jit_depth;
+                size_t m_jit_nodes;
+                unsigned m_tangent_jit_depth;
+                size_t m_tangent_jit_nodes;
             };
 
         public:
@@ -38,7 +82,7 @@ namespace af {
             Variable();
             Variable(const af::array& data, bool calc_grad);
             Variable(const af::array& data,
-                const std::vector<Variable>& inputs,
+                std::vector<Variable> inputs,
                 GradFunc_t grad_func);
 
             af::array& array() const;
@@ -51,6 +95,15 @@ namespace af {
 
             bool isGradAvailable() const;
 
+            // Forward-mode tangent (the "v" of a Jacobian-vector product). Ops
+            // propagate tangents from their inputs as they run, independently of
+            // calc_grad, so they also work under a NoGradGuard.
+            af::array& tangent() const;
+
+            bool isTangentAvailable() const;
+
+            void setTangent(const af::array& tangent);
+
             af::dim4 dims() const;
 
             af::dtype type() const;
@@ -63,20 +116,73 @@ namespace af {
 
             void calcGradInputs(bool retain_grad_graph = false);
 
-            void backward(const Variable& grad, bool retain_grad_graph = false);
+            // With release_graph set, every intermediate node drops its inputs, grad
+            // function and gradient as soon as its gradient has been propagated.
+            // Only the gradients of leaf Variables are kept.
+            void backward(const Variable& grad, bool retain_grad_graph = false, bool release_graph = false);
+
+            void backward(bool retain_grad_graph = false, bool release_graph = false);
+
+            // Backward from several roots (e.g. separate loss terms) in one pass over
+            // a single topological order. Leaf gradients add up across calls until
+            // zeroGrad, so with release_graph set this also accumulates micro-batches
+            // without keeping any micro-batch graph alive.
+            static void backward(const std::vector<Variable>& roots,
+                const std::vector<Variable>& grads,
+                bool retain_grad_graph = false, bool release_graph = false);
 
-            void backward(bool retain_grad_graph = false);
+            static void backward(const std::vector<Variable>& roots,
+                bool retain_grad_graph = false, bool release_graph = false);
+
+            // False while a NoGradGuard is alive on the calling thread. Backward
+            // runs the grad functions with gradients enabled only when
+            // retain_grad_graph is set, so that the gradients are differentiable.
+            static bool isGradEnabled();
+
+            static void setEvalPolicy(const EvalPolicy& policy);
+
+            static EvalPolicy evalPolicy();
+
+            // Counters are process-wide; reset them at the start of a training
+            // step to get per-step numbers.
+            static EvalStats evalStats();
+
+            static void resetEvalStats();
 
         private:
+            // For ops whose result ArrayFire has already materialised (matmul,
+            // reductions): the output starts a new JIT tree.
+            Variable(const af::array& data,
+                std::vector<Variable> inputs,
+                GradFunc_t grad_func,
+                bool evaluated);
+
+            void applyEvalPolicy();
+
+            // Adds grad into the region of this node's gradient selected by idx
+            // along dim. Indices must be unique.
+            void addGrad(const af::array& grad, int dim, const af::index& idx);
+
             void evalGrad(bool retain_grad_graph = false);
 
+            void releaseGraph();
+
             std::vector<Variable>& getInputs() const;
 
             static void buildSubGraph(Cache_t& cache, DAG_t& dag, const Variable& var);
 
             static DAG_t build(const Variable& var);
 
+            static DAG_t build(const std::vector<Variable>& roots);
+
+            static void run(DAG_t& dag, bool retain_grad_graph, bool release_graph);
+
             std::shared_ptr<Shared> m_shared;
+            friend class Tape;
+            friend class BackwardScheduler;
+            friend std::vector<af::array> hvp(const Variable& loss,
+                const std::vector<Variable>& parameters,
+                const std::vector<af::array>& v);
             friend  Variable operator +(const Variable& lhs, const Variable& rhs);
             friend Variable operator *(const Variable& lhs, const Variable& rhs);
             friend Variable operator -(const Variable& lhs, const Variable& rhs);
@@ -124,10 +230,33 @@ namespace af {
             friend  Variable min(const Variable& lhs, const double& rhs);
             friend  Variable min(const double& lhs, const Variable& rhs);
 
+            // Elementwise cond ? lhs : rhs. cond (e.g. a comparison) is not part of
+            // the graph; backward keeps it as a bit-packed mask.
+            friend  Variable select(const Variable& cond, const Variable& lhs, const Variable& rhs);
+            friend  Variable select(const Variable& cond, const Variable& lhs, const double& rhs);
+
+            // ReLU family as single nodes. Backward recomputes the sign mask from
+            // the input, which the graph keeps anyway, so nothing else is saved
+            // (elu reuses its output).
+            friend  Variable relu(const Variable& input);
+            friend  Variable leakyRelu(const Variable& input, double slope);
+            friend  Variable prelu(const Variable& input, const Variable& weight);
+            friend  Variable elu(const Variable& input, double alpha);
+            friend  Variable thresholdRelu(const Variable& input, double threshold);
+
+            // Inverted dropout: drops each element with probability ratio and
+            // scales the rest by 1 / (1 - ratio) in one pass. The mask is drawn
+            // from engine and kept bit-packed for backward.
+            friend  Variable dropout(const Variable& input, double ratio, af::randomEngine& engine);
+
             friend  Variable transpose(const Variable& input);
             friend  Variable tileAs(const Variable& input, const Variable& reference);
             friend  Variable sumAs(const Variable& input, const Variable& reference);
 
+            friend  Variable broadcastAdd(const Variable& lhs, const Variable& rhs);
+            friend  Variable broadcastSub(const Variable& lhs, const Variable& rhs);
+            friend  Variable broadcastMul(const Variable& lhs, const Variable& rhs);
+
             friend  Variable tile(const Variable& input, const std::vector<int>& repeats);
             friend  Variable sum(const Variable& input, const std::vector<int>& axes);
             friend  Variable mean(const Variable& input, const std::vector<int>& axes);
@@ -136,11 +265,74 @@ namespace af {
             friend  Variable matmulTN(const Variable& lhs, const Variable& rhs);
             friend  Variable matmulNT(const Variable& lhs, const Variable& rhs);
 
+            // Sparse (CSR) times dense, with the sparse operand optionally
+            // transposed. Only the dense operand receives a gradient.
+            friend  Variable sparseMatmul(const Variable& sparse, const Variable& dense, bool transpose_sparse);
+
+            // act(matmul(weight, input) + bias) as a single node. Backward computes
+            // the gradients of input, weight and bias together from the output.
+            friend  Variable linear(const Variable& input, const Variable& weight, const Variable& bias, Activation act);
+            friend  Variable linear(const Variable& input, const Variable& weight, Activation act);
+
             friend   Variable abs(const Variable& input);
 
             friend  Variable flat(const Variable& input);
             friend  Variable moddims(const Variable& input, const af::dim4& dims);
+            friend  Variable reorder(const Variable& input, int d0, int d1, int d2, int d3);
+
+            // Maximum along one dimension; backward routes the gradient to the argmax
+            friend  Variable reduceMax(const Variable& input, int dim);
+
+            // im2col and its adjoint (overlapping patches are summed), on the first
+            // two dimensions with the others as batch. See af::unwrap / af::wrap.
+            friend  Variable unwrap(const Variable& input, int wx, int wy, int sx, int sy, int px, int py);
+            friend  Variable wrap(const Variable& input, int ox, int oy, int wx, int wy, int sx, int sy, int px, int py);
+
+            friend  Variable cast(const Variable& input, af::dtype type);
+
+            // Indexing along one dimension. Backward adds into the selected
+            // region of the input's gradient only; gather sums repeated indices.
+            friend  Variable slice(const Variable& input, int dim, int first, int last);
+            friend  Variable index(const Variable& input, int dim, int i);
+            friend  Variable gather(const Variable& input, const af::array& idx, int dim);
+            friend  Variable concat(const std::vector<Variable>& inputs, int dim);
+
+        };
+
+        // Scoped, thread-local inference mode: while alive, operations on the
+        // calling thread neither store their inputs nor their grad closures.
+        // The guard does not make parameters safe to share: the optimizers
+        // reassign each parameter's array in place, so a forward on another
+        // thread must not overlap Optimizer::update on the same parameters
+        // (serialise the two, or serve from a separate copy of the model).
+        class NoGradGuard
+        {
+        private:
+            bool m_prev;
+
+            NoGradGuard(const NoGradGuard&) = delete;
+            NoGradGuard& operator=(const NoGradGuard&) = delete;
+
+        public:
+            NoGradGuard();
+
+            ~NoGradGuard();
+        };
+
+        // Re-enables graph construction on the calling thread for its lifetime,
+        // e.g. to recompute a checkpointed segment inside a grad function.
+        class EnableGradGuard
+        {
+        private:
+            bool m_prev;
+
+            EnableGradGuard(const EnableGradGuard&) = delete;
+            EnableGradGuard& operator=(const EnableGradGuard&) = delete;
+
+        public:
+            EnableGradGuard();
 
+            ~EnableGradGuard();
         };
     }
 }
\ No newline at end of file
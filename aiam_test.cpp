@@ -79,6 +79,7 @@ int main(int argc, const char** args) {
     }
 
     Variable result, l;
+    autograd::Tape tape;
     for (int i = 0; i < 1000; i++) {
         for (int j = 0; j < numSamples; j++) {
 
@@ -94,8 +95,8 @@ int main(int argc, const char** args) {
             // Calculate loss
             l = loss(result, nn::noGrad(out_j));
 
-            // Backward propagation
-            l.backward();
+            // Backward propagation, replaying the schedule recorded on the first step
+            tape.backward(l);
 
             // Update parameters
             optim->update();
@@ -1,3 +1,5 @@
 #pragma once
 #include "Variable.h"
+#include "Tape.h"
+#include "Scheduler.h"
 #include "Functions.h"
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <arrayfire.h>
+
+#include "autograd.h"
+#include "NN.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace af;
+using namespace af::nn;
+using namespace af::autograd;
+
+// Training step time of a Sigmoid / Tanh MLP with and without evaluating the
+// outputs that sigmoid and tanh keep for backward. Evaluating them splits the
+// forward JIT chain; not evaluating them re-runs it inside backward.
+// Usage: bench_activations [iterations] [width] [layers] [batch]
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double run(nn::Sequential& model, const af::array& in, const af::array& out, int iterations)
+{
+    auto loss = nn::MeanSquaredError();
+    auto parameters = model.parameters();
+    auto step = [&]() {
+        for (auto& parameter : parameters) {
+            parameter.zeroGrad();
+        }
+        auto l = loss(model(nn::input(in)), nn::noGrad(out));
+        l.backward();
+        for (auto& parameter : parameters) {
+            parameter.grad().array().eval();
+        }
+    };
+
+    // Warm up the ArrayFire kernel cache
+    step();
+    af::sync();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        step();
+    }
+    af::sync();
+    return seconds(start) / iterations;
+}
+
+int main(int argc, const char** args) {
+    int iterations = argc > 1 ? std::stoi(args[1]) : 100;
+    int width = argc > 2 ? std::stoi(args[2]) : 512;
+    int layers = argc > 3 ? std::stoi(args[3]) : 8;
+    int batch = argc > 4 ? std::stoi(args[4]) : 256;
+
+    auto in = af::randu(width, batch);
+    auto out = af::randu(width, batch);
+
+    for (int act = 0; act < 2; act++) {
+        nn::Sequential model;
+        for (int i = 0; i < layers; i++) {
+            model.add(nn::Linear(width, width));
+            if (act == 0) {
+                model.add(nn::Sigmoid());
+            }
+            else {
+                model.add(nn::Tanh());
+            }
+        }
+        model.train();
+
+        Variable::setEvalPolicy(EvalPolicy(0, 0, false));
+        double lazy = run(model, in, out, iterations);
+        Variable::setEvalPolicy(EvalPolicy(0, 0, true));
+        double saved = run(model, in, out, iterations);
+
+        printf("%-8s lazy outputs %8.3f ms/step   evaluated outputs %8.3f ms/step   speedup %.2fx\n",
+            act == 0 ? "Sigmoid" : "Tanh", lazy * 1000, saved * 1000, lazy / saved);
+    }
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <arrayfire.h>
+
+#include "autograd.h"
+#include "NN.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace af;
+using namespace af::nn;
+using namespace af::autograd;
+
+// Training step time on grid percepts of dims [size, size, channels, batch]
+// for a small convolutional net (two Conv2D + ReLU + MaxPool2D stages and a
+// Linear head) against an MLP that flattens the same percepts into Linear
+// layers. The parameter count of each model is printed next to its time.
+// Usage: bench_conv [iterations] [size] [channels] [batch] [hidden]
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t count(const std::vector<Variable>& parameters)
+{
+    size_t n = 0;
+    for (auto& parameter : parameters) {
+        n += parameter.array().elements();
+    }
+    return n;
+}
+
+static double run(std::function<Variable(const Variable&)> model, std::vector<Variable> parameters,
+    const af::array& in, const af::array& out, int iterations)
+{
+    auto loss = nn::MeanSquaredError();
+    auto step = [&]() {
+        for (auto& parameter : parameters) {
+            parameter.zeroGrad();
+        }
+        auto l = loss(model(nn::input(in)), nn::noGrad(out));
+        l.backward();
+        for (auto& parameter : parameters) {
+            parameter.grad().array().eval();
+        }
+    };
+
+    // Warm up the ArrayFire kernel cache
+    step();
+    af::sync();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        step();
+    }
+    af::sync();
+    return seconds(start) / iterations;
+}
+
+int main(int argc, const char** args) {
+    int iterations = argc > 1 ? std::stoi(args[1]) : 50;
+    int size = argc > 2 ? std::stoi(args[2]) : 32;
+    int channels = argc > 3 ? std::stoi(args[3]) : 3;
+    int batch = argc > 4 ? std::stoi(args[4]) : 64;
+    int hidden = argc > 5 ? std::stoi(args[5]) : 256;
+    const int outputs = 10;
+
+    auto in = af::randu(size, size, channels, batch);
+    auto out = af::randu(outputs, batch);
+
+    // Two same-padded 3x3 stages, each halving the grid
+    nn::Sequential features;
+    features.add(nn::Conv2D(channels, 16, 3, 3, 1, 1, 1, 1));
+    features.add(nn::ReLU());
+    features.add(nn::MaxPool2D(2, 2));
+    features.add(nn::Conv2D(16, 32, 3, 3, 1, 1, 1, 1));
+    features.add(nn::ReLU());
+    features.add(nn::MaxPool2D(2, 2));
+    int reduced = (size / 4) * (size / 4) * 32;
+    nn::Linear conv_head(reduced, outputs);
+    features.train();
+
+    auto conv_parameters = features.parameters();
+    for (auto& parameter : conv_head.parameters()) {
+        conv_parameters.push_back(parameter);
+    }
+    auto conv = [&](const Variable& x) {
+        auto h = features(x);
+        return conv_head(moddims(h, af::dim4(reduced, batch)));
+    };
+
+    int flat = size * size * channels;
+    nn::Sequential mlp;
+    mlp.add(nn::Linear(flat, hidden));
+    mlp.add(nn::ReLU());
+    mlp.add(nn::Linear(hidden, hidden));
+    mlp.add(nn::ReLU());
+    mlp.add(nn::Linear(hidden, outputs));
+    mlp.train();
+
+    auto flattened = [&](const Variable& x) {
+        return mlp(moddims(x, af::dim4(flat, batch)));
+    };
+
+    double conv_time = run(conv, conv_parameters, in, out, iterations);
+    double mlp_time = run(flattened, mlp.parameters(), in, out, iterations);
+
+    printf("Conv2D          %8.3f ms/step   %8zu parameters\n", conv_time * 1000, count(conv_parameters));
+    printf("Linear (flat)   %8.3f ms/step   %8zu parameters\n", mlp_time * 1000, count(mlp.parameters()));
+    printf("Conv2D / Linear %.2fx\n", conv_time / mlp_time);
+
+    return 0;
+}
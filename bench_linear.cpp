@@ -0,0 +1,97 @@
+#include <iostream>
+#include <arrayfire.h>
+
+#include "autograd.h"
+#include "NN.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace af;
+using namespace af::nn;
+using namespace af::autograd;
+
+// Training throughput of an MLP built from FusedLinear layers against the same
+// MLP built from Linear followed by a separate activation module, for each of
+// ReLU, Sigmoid and Tanh. Both models share the same weight Variables, so the
+// losses printed alongside should agree.
+// Usage: bench_linear [iterations] [width] [layers] [batch]
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double run(nn::Sequential& model, const af::array& in, const af::array& out, int iterations, float& last_loss)
+{
+    auto loss = nn::MeanSquaredError();
+    auto parameters = model.parameters();
+    auto step = [&]() {
+        for (auto& parameter : parameters) {
+            parameter.zeroGrad();
+        }
+        auto l = loss(model(nn::input(in)), nn::noGrad(out));
+        l.backward();
+        for (auto& parameter : parameters) {
+            parameter.grad().array().eval();
+        }
+        return l;
+    };
+
+    // Warm up the ArrayFire kernel cache
+    last_loss = af::sum<float>(step().array());
+    af::sync();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        step();
+    }
+    af::sync();
+    return seconds(start) / iterations;
+}
+
+int main(int argc, const char** args) {
+    int iterations = argc > 1 ? std::stoi(args[1]) : 100;
+    int width = argc > 2 ? std::stoi(args[2]) : 512;
+    int layers = argc > 3 ? std::stoi(args[3]) : 8;
+    int batch = argc > 4 ? std::stoi(args[4]) : 256;
+
+    auto in = af::randu(width, batch);
+    auto out = af::randu(width, batch);
+
+    const Activation activations[] = { Activation::ReLU, Activation::Sigmoid, Activation::Tanh };
+    const char* names[] = { "ReLU", "Sigmoid", "Tanh" };
+
+    for (int act = 0; act < 3; act++) {
+        nn::Sequential fused;
+        nn::Sequential split;
+        for (int i = 0; i < layers; i++) {
+            auto w = nn::lecunNormal(width, width);
+            auto b = nn::lecunNormal(width, 1);
+            fused.add(nn::FusedLinear(w, b, activations[act]));
+            split.add(nn::Linear(w, b));
+            if (activations[act] == Activation::ReLU) {
+                split.add(nn::ReLU());
+            }
+            else if (activations[act] == Activation::Sigmoid) {
+                split.add(nn::Sigmoid());
+            }
+            else {
+                split.add(nn::Tanh());
+            }
+        }
+        fused.train();
+        split.train();
+
+        float fused_loss = 0;
+        float split_loss = 0;
+        double fused_time = run(fused, in, out, iterations, fused_loss);
+        double split_time = run(split, in, out, iterations, split_loss);
+
+        printf("%-8s Linear+act %8.3f ms/step   FusedLinear %8.3f ms/step   speedup %.2fx   loss %g / %g\n",
+            names[act], split_time * 1000, fused_time * 1000, split_time / fused_time, split_loss, fused_loss);
+    }
+
+    return 0;
+}
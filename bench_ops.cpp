@@ -0,0 +1,81 @@
+#include <iostream>
+#include <arrayfire.h>
+
+#include "autograd.h"
+#include "NN.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace af;
+using namespace af::nn;
+using namespace af::autograd;
+
+// Graph construction and backward throughput for small elementwise and matmul
+// ops, where per-node overhead (node, input vector and closure allocations)
+// dominates the ArrayFire work. Usage: bench_ops [iterations] [ops_per_iteration]
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Five ops per step: a matmul, two elementwise ops, a scalar op and a tanh,
+// whose closure captures its saved output.
+static Variable chain(const Variable& x, const Variable& w, int steps)
+{
+    Variable h = x;
+    for (int i = 0; i < steps; i++) {
+        h = matmul(w, h);
+        h = h * x + h;
+        h = 0.5 * h;
+        h = tanh(h);
+    }
+    return h;
+}
+
+static void report(const std::string& name, long long ops, double time)
+{
+    printf("%-28s %12.0f ops/s  (%lld ops in %.3f s)\n", name.c_str(), ops / time, ops, time);
+}
+
+int main(int argc, const char** args) {
+    int iterations = argc > 1 ? std::stoi(args[1]) : 200;
+    int steps = argc > 2 ? std::stoi(args[2]) : 100;
+    const int size = 4;
+    const long long ops = (long long)iterations * steps * 5;
+
+    auto x = nn::input(af::randu(size, 1));
+    auto w = nn::parameter(af::randu(size, size));
+
+    // Warm up the node free list and the ArrayFire kernel cache
+    chain(x, w, steps).backward();
+    af::sync();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        NoGradGuard guard;
+        chain(x, w, steps).array().eval();
+    }
+    af::sync();
+    report("forward, no graph", ops, seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        chain(x, w, steps).array().eval();
+    }
+    af::sync();
+    report("forward, graph recorded", ops, seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        w.zeroGrad();
+        chain(x, w, steps).backward();
+        w.grad().array().eval();
+    }
+    af::sync();
+    report("forward + backward", ops, seconds(start));
+
+    return 0;
+}
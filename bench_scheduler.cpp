@@ -0,0 +1,143 @@
+#include <iostream>
+#include <arrayfire.h>
+
+#include "autograd.h"
+#include "NN.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace af;
+using namespace af::nn;
+using namespace af::autograd;
+
+// Backward time of a wide model (many independent Linear/Tanh branches summed
+// into one loss) with the serial Variable::backward and with the
+// BackwardScheduler at 1..N threads. Every scheduled run is checked against
+// the serial gradients first.
+// Usage: bench_scheduler [iterations] [branches] [depth] [width] [batch] [threads]
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Model {
+    std::vector<std::vector<nn::Linear>> branches;
+    std::vector<Variable> parameters;
+
+    Model(int num_branches, int depth, int width)
+    {
+        for (int b = 0; b < num_branches; b++) {
+            std::vector<nn::Linear> branch;
+            for (int d = 0; d < depth; d++) {
+                branch.emplace_back(width, width);
+                for (auto& parameter : branch.back().parameters()) {
+                    parameters.push_back(parameter);
+                }
+            }
+            branches.push_back(branch);
+        }
+    }
+
+    Variable loss(const Variable& in)
+    {
+        Variable total;
+        for (size_t b = 0; b < branches.size(); b++) {
+            auto h = in;
+            for (auto& layer : branches[b]) {
+                h = tanh(layer(h));
+            }
+            auto l = sum(h * h, {0, 1});
+            total = b == 0 ? l : total + l;
+        }
+        return total;
+    }
+
+    void zeroGrad()
+    {
+        for (auto& parameter : parameters) {
+            parameter.zeroGrad();
+        }
+    }
+
+    void evalGrads()
+    {
+        for (auto& parameter : parameters) {
+            parameter.grad().array().eval();
+        }
+    }
+};
+
+template<typename Backward>
+static double run(Model& model, const Variable& in, int iterations, Backward backward)
+{
+    auto step = [&]() {
+        model.zeroGrad();
+        backward(model.loss(in));
+        model.evalGrads();
+    };
+
+    // Warm up the ArrayFire kernel cache
+    step();
+    af::sync();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        step();
+    }
+    af::sync();
+    return seconds(start) / iterations;
+}
+
+int main(int argc, const char** args) {
+    int iterations = argc > 1 ? std::stoi(args[1]) : 50;
+    int branches = argc > 2 ? std::stoi(args[2]) : 16;
+    int depth = argc > 3 ? std::stoi(args[3]) : 4;
+    int width = argc > 4 ? std::stoi(args[4]) : 256;
+    int batch = argc > 5 ? std::stoi(args[5]) : 64;
+    int max_threads = argc > 6 ? std::stoi(args[6]) : (int)std::thread::hardware_concurrency();
+
+    Model model(branches, depth, width);
+    auto in = nn::input(af::randu(width, batch));
+
+    // Reference gradients from the serial path
+    model.zeroGrad();
+    model.loss(in).backward();
+    std::vector<af::array> reference;
+    for (auto& parameter : model.parameters) {
+        reference.push_back(parameter.grad().array().copy());
+    }
+
+    double serial = run(model, in, iterations, [](Variable l) { l.backward(); });
+    printf("serial        %8.3f ms/step\n", serial * 1000);
+
+    bool matched = true;
+    for (int threads = 1; threads <= std::max(max_threads, 1); threads *= 2) {
+        BackwardScheduler scheduler(threads);
+
+        model.zeroGrad();
+        scheduler.backward(model.loss(in));
+        float max_diff = 0;
+        float max_ref = 0;
+        for (size_t i = 0; i < reference.size(); i++) {
+            auto grad = model.parameters[i].grad().array();
+            max_diff = std::max(max_diff, af::max<float>(af::abs(grad - reference[i])));
+            max_ref = std::max(max_ref, af::max<float>(af::abs(reference[i])));
+        }
+        // Only the summation order of a node's incoming gradients may differ
+        bool ok = max_diff <= 1e-4f * std::max(max_ref, 1.0f);
+        matched = matched && ok;
+
+        double scheduled = run(model, in, iterations,
+            [&scheduler](const Variable& l) { scheduler.backward(l); });
+        printf("%2d threads    %8.3f ms/step   speedup %.2fx   max grad diff %g %s\n",
+            threads, scheduled * 1000, serial / scheduled, max_diff, ok ? "ok" : "MISMATCH");
+    }
+
+    return matched ? 0 : 1;
+}
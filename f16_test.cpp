@@ -0,0 +1,60 @@
+#include <iostream>
+#include <arrayfire.h>
+
+#include "autograd.h"
+#include "NN.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace af;
+using namespace af::nn;
+using namespace af::autograd;
+
+// Backward through Linear stacks cast to f16. Every layer's backward has to
+// hand an f16 gradient to the matmul before it, and every parameter must end
+// up with an f16 gradient.
+
+static bool check(const char* name, nn::Sequential& model, int input_size, int output_size)
+{
+    model.cast(f16);
+    model.train();
+
+    auto in = af::randu(input_size, 8).as(f16);
+    auto out = af::randu(output_size, 8).as(f16);
+    auto loss = nn::MeanSquaredError();
+
+    bool ok = true;
+    try {
+        auto l = loss(model(nn::input(in)), nn::noGrad(out));
+        l.backward();
+        for (auto& parameter : model.parameters()) {
+            ok = ok && parameter.grad().type() == f16;
+        }
+    }
+    catch (const af::exception& e) {
+        printf("%s: %s\n", name, e.what());
+        ok = false;
+    }
+    printf("%-24s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, const char** args) {
+    bool ok = true;
+
+    nn::Sequential leaky;
+    leaky.add(nn::Linear(16, 32));
+    leaky.add(nn::LeakyReLU(0.1));
+    leaky.add(nn::Linear(32, 4));
+    ok = check("Linear + LeakyReLU", leaky, 16, 4) && ok;
+
+    nn::Sequential dropout;
+    dropout.add(nn::Linear(16, 32));
+    dropout.add(nn::ReLU());
+    dropout.add(nn::Dropout(0.5));
+    dropout.add(nn::Linear(32, 4));
+    ok = check("Linear + Dropout", dropout, 16, 4) && ok;
+
+    return ok ? 0 : 1;
+}